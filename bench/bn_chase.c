@@ -0,0 +1,88 @@
+/* pointer chasing: keys from the input go into a chained hash table and
+   a binary search tree, which are then looked up repeatedly. the nodes
+   are spread over the heap, so this exercises the shadow map lookups.
+   usage: bn_chase <file> [rounds] */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BUCKETS 4096
+
+typedef struct Node {
+  uint32_t key;
+  uint32_t count;
+  struct Node* next;       // hash chain
+  struct Node* left;
+  struct Node* right;
+} Node;
+
+static Node* table[BUCKETS];
+static Node* root;
+
+static Node* insert(uint32_t key){
+  Node** p = &table[(key * 2654435761u) % BUCKETS];
+  for(Node* n = *p; n != NULL; n = n->next){
+    if(n->key == key){
+      n->count++;
+      return n;
+    }
+  }
+  Node* n = calloc(1, sizeof(Node));
+  n->key = key;
+  n->count = 1;
+  n->next = *p;
+  *p = n;
+
+  Node** t = &root;
+  while(*t != NULL){
+    t = (key < (*t)->key)? &(*t)->left : &(*t)->right;
+  }
+  *t = n;
+  return n;
+}
+
+static uint32_t lookup(uint32_t key){
+  Node* t = root;
+  while(t != NULL && t->key != key){
+    t = (key < t->key)? t->left : t->right;
+  }
+  return (t == NULL)? 0 : t->count;
+}
+
+int main(int argc, char** argv){
+  static unsigned char buf[1 << 16];
+  int rounds = (argc > 2)? atoi(argv[2]) : 4;
+  uint32_t* keys = NULL;
+  size_t n_keys = 0, size = 0;
+  ssize_t n;
+  int fd;
+
+  if(argc < 2 || (fd = open(argv[1], O_RDONLY)) < 0){
+    fprintf(stderr, "usage: bn_chase <file> [rounds]\n");
+    return 1;
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(ssize_t i = 0; i + 3 <= n; i += 3){
+      if(n_keys == size){
+        size = (size == 0)? 4096 : 2*size;
+        keys = realloc(keys, size * sizeof(uint32_t));
+      }
+      // 24 bit keys, so some of them repeat
+      keys[n_keys] = buf[i] | (buf[i+1] << 8) | (buf[i+2] << 16);
+      insert(keys[n_keys++]);
+    }
+  }
+  close(fd);
+
+  uint64_t total = 0;
+  for(int r = 0; r < rounds; r++){
+    for(size_t i = 0; i < n_keys; i++){
+      total += lookup(keys[(i * 7919) % n_keys]);
+    }
+  }
+  printf("%zu keys, %llu\n", n_keys, (unsigned long long)total);
+  free(keys);
+  return 0;
+}
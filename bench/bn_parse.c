@@ -0,0 +1,80 @@
+/* memcpy heavy parsing: the input is split into lines and fields, which
+   are copied into records with memcpy and strcpy and then sorted. this
+   exercises the function replacements and the stores of copied data.
+   usage: bn_parse <file> */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FIELD 32
+
+typedef struct {
+  char key[FIELD];
+  char value[FIELD];
+  unsigned len;
+} Record;
+
+static int cmp_records(const void* a, const void* b){
+  return memcmp(((const Record*)a)->key, ((const Record*)b)->key, FIELD);
+}
+
+int main(int argc, char** argv){
+  struct stat st;
+  int fd;
+
+  if(argc < 2 || (fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) != 0){
+    fprintf(stderr, "usage: bn_parse <file>\n");
+    return 1;
+  }
+  char* text = malloc(st.st_size + 1);
+  size_t got = 0;
+  ssize_t n;
+  while(got < (size_t)st.st_size && (n = read(fd, text + got, st.st_size - got)) > 0){
+    got += n;
+  }
+  close(fd);
+  text[got] = '\0';
+
+  // a line is a record, anything up to the first byte below '0' is its
+  // key and the rest is its value. random input makes short lines
+  size_t n_records = 0, size = 1024;
+  Record* records = malloc(size * sizeof(Record));
+  char* line = text;
+  while(line < text + got){
+    char* end = memchr(line, '\n', text + got - line);
+    size_t len = (end == NULL)? (size_t)(text + got - line) : (size_t)(end - line);
+    size_t k = 0;
+    while(k < len && k < FIELD-1 && (unsigned char)line[k] >= '0'){
+      k++;
+    }
+
+    if(n_records == size){
+      size *= 2;
+      records = realloc(records, size * sizeof(Record));
+    }
+    Record* r = &records[n_records++];
+    memset(r, 0, sizeof(*r));
+    memcpy(r->key, line, k);
+    char tmp[FIELD];
+    size_t v = (len - k < FIELD-1)? len - k : FIELD-1;
+    memcpy(tmp, line + k, v);
+    tmp[v] = '\0';
+    strcpy(r->value, tmp);
+    r->len = len;
+
+    line += len + 1;
+  }
+
+  qsort(records, n_records, sizeof(Record), cmp_records);
+  unsigned long total = 0;
+  for(size_t i = 0; i < n_records; i++){
+    total += records[i].len + (unsigned char)records[i].key[0];
+  }
+  printf("%zu records, %lu\n", n_records, total);
+  free(records);
+  free(text);
+  return 0;
+}
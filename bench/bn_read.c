@@ -0,0 +1,30 @@
+/* bulk read(): the whole file is read in chunks of the given size and
+   every byte is touched once, which exercises taint_range and the load
+   shadows. usage: bn_read <file> [chunk bytes] */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char** argv){
+  size_t chunk = (argc > 2)? strtoul(argv[2], NULL, 0) : 65536;
+  unsigned char* buf = malloc(chunk);
+  unsigned long sum = 0, total = 0;
+  ssize_t n;
+  int fd;
+
+  if(argc < 2 || buf == NULL || (fd = open(argv[1], O_RDONLY)) < 0){
+    fprintf(stderr, "usage: bn_read <file> [chunk bytes]\n");
+    return 1;
+  }
+  while((n = read(fd, buf, chunk)) > 0){
+    for(ssize_t i = 0; i < n; i++){
+      sum += buf[i];
+    }
+    total += n;
+  }
+  close(fd);
+  printf("%lu bytes, sum %lu\n", total, sum);
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,67 @@
+/* multithreaded readers: every thread opens the file, reads its own
+   slice of it and folds it into a checksum. usage: bn_threads <file>
+   [threads] */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  const char* path;
+  off_t start;
+  off_t len;
+  unsigned long sum;
+} Slice;
+
+static void* reader(void* arg){
+  Slice* s = arg;
+  unsigned char buf[16384];
+  int fd = open(s->path, O_RDONLY);
+  if(fd < 0 || lseek(fd, s->start, SEEK_SET) != s->start){
+    return NULL;
+  }
+  off_t left = s->len;
+  while(left > 0){
+    ssize_t n = read(fd, buf, (left < (off_t)sizeof(buf))? (size_t)left : sizeof(buf));
+    if(n <= 0){
+      break;
+    }
+    for(ssize_t i = 0; i < n; i++){
+      s->sum = s->sum * 31 + buf[i];
+    }
+    left -= n;
+  }
+  close(fd);
+  return NULL;
+}
+
+int main(int argc, char** argv){
+  int n_threads = (argc > 2)? atoi(argv[2]) : 4;
+  struct stat st;
+
+  if(argc < 2 || n_threads < 1 || stat(argv[1], &st) != 0){
+    fprintf(stderr, "usage: bn_threads <file> [threads]\n");
+    return 1;
+  }
+  pthread_t* threads = malloc(n_threads * sizeof(pthread_t));
+  Slice* slices = calloc(n_threads, sizeof(Slice));
+  off_t per = st.st_size / n_threads;
+
+  for(int i = 0; i < n_threads; i++){
+    slices[i].path = argv[1];
+    slices[i].start = i * per;
+    slices[i].len = (i == n_threads-1)? st.st_size - i * per : per;
+    pthread_create(&threads[i], NULL, reader, &slices[i]);
+  }
+  unsigned long sum = 0;
+  for(int i = 0; i < n_threads; i++){
+    pthread_join(threads[i], NULL);
+    sum ^= slices[i].sum;
+  }
+  printf("%d threads, %lu\n", n_threads, sum);
+  free(threads);
+  free(slices);
+  return 0;
+}
@@ -0,0 +1,93 @@
+#!/bin/bash
+# Overhead harness for the guest programs in this directory. Every
+# program is run on inputs of every size, once under --tool=none and
+# once under ddtector, and a table is printed with
+#
+#   none, dd    wall clock seconds of the two runs
+#   slowdown    dd / none
+#   rss_kb      peak RSS of the ddtector run (needs /usr/bin/time)
+#   helpers/s   helper calls per second of the ddtector run
+#   labels/s    labels merged by set unions per second
+#
+# the last two come from the "dd:" lines ddtector prints with
+# --stats=yes. usage, from anywhere:
+#
+#   bench/run.sh [ddtector options...]
+#
+# and the environment may set
+#
+#   VALGRIND  the valgrind to run [valgrind]
+#   SIZES     input sizes in bytes [1024 1048576 16777216], add
+#             104857600 for the 100MB runs
+#   PROGS     programs to run [read hash parse chase threads]
+#   OUT       file the table is also written to [bench_output.txt]
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+VALGRIND=${VALGRIND:-valgrind}
+SIZES=${SIZES:-"1024 1048576 16777216"}
+PROGS=${PROGS:-"read hash parse chase threads"}
+OUT=${OUT:-bench_output.txt}
+BUILD=$BENCH/build
+
+mkdir -p "$BUILD" || exit 1
+for p in $PROGS; do
+  if [ ! -x "$BUILD/bn_$p" ] || [ "$BENCH/bn_$p.c" -nt "$BUILD/bn_$p" ]; then
+    ${CC:-cc} -O2 -g -pthread -o "$BUILD/bn_$p" "$BENCH/bn_$p.c" || exit 1
+  fi
+done
+
+# base64 text, so the parser finds lines and fields
+for size in $SIZES; do
+  if [ ! -f "$BUILD/input_$size" ]; then
+    head -c "$size" /dev/urandom | base64 | head -c "$size" > "$BUILD/input_$size" || exit 1
+  fi
+done
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+# run_tool <tool> <tool options> <program> <args>: prints the seconds
+# taken, leaves the tool's messages in $TMP/err and the peak RSS in
+# $TMP/rss
+run_tool(){
+  local tool=$1
+  shift
+  local start end
+  start=$(date +%s.%N)
+  if [ -x /usr/bin/time ]; then
+    /usr/bin/time -f %M -o "$TMP/rss" "$VALGRIND" --tool="$tool" "$@" > /dev/null 2> "$TMP/err"
+  else
+    "$VALGRIND" --tool="$tool" "$@" > /dev/null 2> "$TMP/err"
+    echo - > "$TMP/rss"
+  fi
+  end=$(date +%s.%N)
+  awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f", e - s }'
+}
+
+# the number in front of $1 on the "dd:" stats lines
+dd_stat(){
+  sed -n "s/^==[0-9]*== dd: \(.*[^0-9]\)\{0,1\}\([0-9][0-9]*\) $1.*/\2/p" "$TMP/err" | head -n 1
+}
+
+{
+  printf "# %s %s\n" "$("$VALGRIND" --version 2>/dev/null)" "$*"
+  printf "%-8s %10s %9s %9s %9s %10s %12s %12s\n" \
+         prog size none dd slowdown rss_kb helpers/s labels/s
+} | tee "$OUT"
+
+for p in $PROGS; do
+  for size in $SIZES; do
+    input=$BUILD/input_$size
+    none=$(run_tool none "$BUILD/bn_$p" "$input")
+    dd=$(run_tool ddtector --stats=yes "$@" "$BUILD/bn_$p" "$input")
+    rss=$(cat "$TMP/rss")
+    helpers=$(dd_stat "helper calls,")
+    labels=$(dd_stat labels)
+    awk -v p="$p" -v size="$size" -v none="$none" -v dd="$dd" -v rss="$rss" \
+        -v helpers="${helpers:-0}" -v labels="${labels:-0}" 'BEGIN {
+      printf "%-8s %10d %9.3f %9.3f %9.1f %10s %12.0f %12.0f\n", p, size, none, dd,
+             (none > 0)? dd / none : 0, rss, (dd > 0)? helpers / dd : 0,
+             (dd > 0)? labels / dd : 0
+    }'
+  done
+done | tee -a "$OUT"
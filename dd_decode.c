@@ -0,0 +1,294 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Decoder for the binary provenance log.            dd_decode.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   Reads a log written with --dd-log-file= and prints it in the same
+   [DD] text format the tool prints on stdout without that option.
+   Each label is printed as the source and the offset it was read from.
+
+   This is a normal host program, build it with
+
+      gcc -O2 -o dd_decode dd_decode.c
+
+   and run it as
+
+      ./dd_decode <log file>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dd_logformat.h"
+
+// a set is either n labels, or with --dd-max-labels= n ranges stored as
+// lo, hi pairs in labels
+typedef struct {
+  unsigned long n;
+  unsigned long* labels;
+  int ranges;
+  int approx;
+} Set;
+
+// set id -> labels
+static Set* sets = NULL;
+static unsigned long n_sets = 0;
+
+// label pages in the order they were handed out, see DD_REC_PAGE
+typedef struct {
+  unsigned long source;
+  unsigned long page;
+} Page;
+
+static Page* pages = NULL;
+static unsigned long n_pages = 0;
+static unsigned long pages_size = 0;
+
+// source id -> name
+static char** names = NULL;
+static unsigned long n_names = 0;
+
+static FILE* in;
+
+// log2 of the bytes covered by one label
+static int gran_shift;
+
+static void die(const char* msg){
+  fprintf(stderr, "dd_decode: %s\n", msg);
+  exit(1);
+}
+
+static unsigned long read_uleb(void){
+  unsigned long v = 0;
+  int shift = 0;
+  int c;
+  do{
+    c = getc(in);
+    if(c == EOF){
+      die("truncated log");
+    }
+    v |= (unsigned long)(c & 0x7F) << shift;
+    shift += 7;
+  } while(c & 0x80);
+  return v;
+}
+
+// undo the zigzag delta encoding against 'prev'
+static unsigned long read_delta(unsigned long prev){
+  unsigned long z = read_uleb();
+  long d = (long)(z >> 1) ^ -(long)(z & 1);
+  return prev + d;
+}
+
+static void read_page(void){
+  if(n_pages == pages_size){
+    pages_size = (pages_size == 0)? 256 : 2*pages_size;
+    pages = realloc(pages, pages_size*sizeof(Page));
+  }
+  pages[n_pages].source = read_uleb();
+  pages[n_pages].page = read_uleb();
+  n_pages++;
+}
+
+static void read_name(void){
+  unsigned long id = read_uleb();
+  unsigned long n = read_uleb();
+  if(id >= n_names){
+    unsigned long new_n = (id+1 > 2*n_names)? id+1 : 2*n_names;
+    names = realloc(names, new_n*sizeof(char*));
+    memset(names + n_names, 0, (new_n - n_names)*sizeof(char*));
+    n_names = new_n;
+  }
+  free(names[id]);
+  names[id] = malloc(n + 1);
+  if(fread(names[id], 1, n, in) != n){
+    die("truncated log");
+  }
+  names[id][n] = 0;
+  printf("[DD]: source %lu is %s\n", id, names[id]);
+}
+
+static Set* define_set(unsigned long id){
+  if(id >= n_sets){
+    unsigned long new_n = (id+1 > 2*n_sets)? id+1 : 2*n_sets;
+    sets = realloc(sets, new_n*sizeof(Set));
+    memset(sets + n_sets, 0, (new_n - n_sets)*sizeof(Set));
+    n_sets = new_n;
+  }
+  // an id is defined again after its old set was dropped by the tool
+  free(sets[id].labels);
+  return &sets[id];
+}
+
+static void read_set(void){
+  unsigned long id = read_uleb();
+  unsigned long n = read_uleb();
+  unsigned long label = 0;
+  Set* s = define_set(id);
+
+  s->n = n;
+  s->ranges = 0;
+  s->approx = 0;
+  s->labels = malloc(n*sizeof(unsigned long));
+  for(unsigned long i = 0; i < n; i++){
+    label += read_uleb();
+    s->labels[i] = label;
+  }
+}
+
+static void read_ranges(void){
+  unsigned long id = read_uleb();
+  int approx = (int)read_uleb();
+  unsigned long n = read_uleb();
+  unsigned long label = 0;
+  Set* s = define_set(id);
+
+  s->n = n;
+  s->ranges = 1;
+  s->approx = approx;
+  s->labels = malloc(2*n*sizeof(unsigned long));
+  for(unsigned long i = 0; i < n; i++){
+    label += read_uleb();
+    s->labels[2*i] = label;
+    label += read_uleb();
+    s->labels[2*i+1] = label;
+  }
+}
+
+// the page of a label, and the offset of the first byte it stands for
+static Page* label_page(unsigned long label){
+  unsigned long n = label >> (DD_LABEL_PAGE_BITS - gran_shift);
+  if(n >= n_pages){
+    die("use of an unknown label");
+  }
+  return &pages[n];
+}
+
+static unsigned long label_offset(unsigned long label){
+  unsigned long mask = (1UL << (DD_LABEL_PAGE_BITS - gran_shift)) - 1;
+  return (label_page(label)->page << DD_LABEL_PAGE_BITS) + ((label & mask) << gran_shift);
+}
+
+// print a label as its source and offset
+static void print_label(unsigned long label){
+  printf("[%lu:%lu] ", label_page(label)->source, label_offset(label));
+}
+
+// print the ranges of a set the way the tool prints them
+static void print_ranges(Set* s){
+  if(s->approx){
+    printf("~");
+  }
+  for(unsigned long i = 0; i < s->n; i++){
+    unsigned long lo = s->labels[2*i], hi = s->labels[2*i+1];
+    if(lo == hi){
+      print_label(lo);
+    }
+    else{
+      printf("[%lu:%lu..%lu:%lu] ", label_page(lo)->source, label_offset(lo),
+             label_page(hi)->source, label_offset(hi));
+    }
+  }
+}
+
+static void print_access(unsigned long addr, unsigned long id){
+  printf("0x%08lx [DD]: ", addr);
+  if(id & DD_SINGLETON_BIT){
+    print_label(id & ~DD_SINGLETON_BIT);
+  }
+  else{
+    if(id >= n_sets || sets[id].labels == NULL){
+      die("use of an undefined set");
+    }
+    else if(sets[id].ranges){
+      print_ranges(&sets[id]);
+    }
+    else{
+      for(unsigned long i = 0; i < sets[id].n; i++){
+        print_label(sets[id].labels[i]);
+      }
+    }
+  }
+  printf("\n");
+}
+
+int main(int argc, char** argv){
+  char magic[DD_LOG_MAGIC_LEN];
+  unsigned long prev_addr = 0;
+  unsigned long prev_set = 0;
+  int tag;
+
+  if(argc != 2){
+    fprintf(stderr, "usage: dd_decode <log file>\n");
+    return 1;
+  }
+
+  in = fopen(argv[1], "rb");
+  if(in == NULL){
+    perror(argv[1]);
+    return 1;
+  }
+  if(fread(magic, 1, DD_LOG_MAGIC_LEN, in) != DD_LOG_MAGIC_LEN
+     || memcmp(magic, DD_LOG_MAGIC, DD_LOG_MAGIC_LEN) != 0){
+    die("not a provenance log");
+  }
+  gran_shift = getc(in);
+  if(gran_shift == EOF){
+    die("truncated log");
+  }
+
+  while((tag = getc(in)) != EOF){
+    switch(tag){
+      case DD_REC_SET:
+        read_set();
+        break;
+      case DD_REC_RANGES:
+        read_ranges();
+        break;
+      case DD_REC_PAGE:
+        read_page();
+        break;
+      case DD_REC_NAME:
+        read_name();
+        break;
+      case DD_REC_SOURCE:
+      {
+        unsigned long addr = read_delta(prev_addr);
+        unsigned long source = read_uleb();
+        unsigned long offset = read_uleb();
+        unsigned long len = read_uleb();
+        printf("0x%08lx [DD]: source %lu, offset %lu, %lu bytes\n", addr, source, offset, len);
+        prev_addr = addr;
+        break;
+      }
+      case DD_REC_STORE:
+      {
+        unsigned long addr = read_delta(prev_addr);
+        unsigned long set = read_delta(prev_set);
+        print_access(addr, set);
+        prev_addr = addr;
+        prev_set = set;
+        break;
+      }
+      case DD_REC_TAINTED:
+      {
+        unsigned long addr = read_delta(prev_addr);
+        unsigned long n = read_uleb();
+        printf("0x%08lx [DD]: tainted, %lu %s\n", addr, n, (gran_shift == 0)? "bytes" : "cells");
+        prev_addr = addr;
+        break;
+      }
+      default:
+        die("unknown record");
+    }
+  }
+
+  fclose(in);
+  return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,85 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Binary provenance log format.                  dd_logformat.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   Shared by the tool (dd_main.c, --dd-log-file=) and the offline
+   decoder (dd_decode.c). Only constants live here so the decoder can be
+   built without the valgrind headers.
+
+   The log starts with the 8 byte DD_LOG_MAGIC and one byte holding
+   log2 of --dd-granularity. It is followed by records, each a one byte
+   tag and then unsigned LEB128 varints:
+
+     DD_REC_SET     id, n, label_0, label_1 - label_0, ...
+                    defines a set, labels are sorted so every label after
+                    the first is a positive delta. a set is defined
+                    before the first record that uses it. the tool reuses
+                    the ids of sets it dropped, so an id may be defined
+                    again, replacing the earlier set.
+
+     DD_REC_SOURCE  addr, source, offset, len
+                    len bytes were read from offset on in source into
+                    [addr, addr+len). a cell, an aligned block of
+                    1 << granularity bytes, got the label of the offset
+                    of its first byte in the range.
+
+     DD_REC_STORE   addr, set
+                    a tainted value was stored at addr.
+
+     DD_REC_RANGES  id, approx, n, lo_0, hi_0 - lo_0, lo_1 - hi_0, ...
+                    defines a set kept as n sorted ranges of labels with
+                    --dd-max-labels=, each lo is a delta against the hi of
+                    the range before it. approx is 1 when the ranges also
+                    hold labels that are not really in the set. ids are
+                    shared with DD_REC_SET.
+
+     DD_REC_PAGE    source, page
+                    the next page of labels, numbered from 0 in the order
+                    of these records, was handed out for the bytes of
+                    source from offset page << DD_LABEL_PAGE_BITS on. the
+                    label of the cell at offset o of that page is
+                    (number << (DD_LABEL_PAGE_BITS - granularity))
+                    + (o >> granularity). a page is defined before the
+                    first SOURCE record that uses it.
+
+     DD_REC_NAME    source, n, bytes
+                    source, a number from 1, is the n byte name that
+                    follows, not varints. it comes before the first
+                    SOURCE record of the source.
+
+     DD_REC_TAINTED addr, n
+                    a query with --dd-mode=bool found the n cells from
+                    addr on tainted.
+
+   In SOURCE, STORE and TAINTED records addr is a zigzag encoded delta
+   against the addr of the previous such record, in STORE records set is
+   one against the set of the previous STORE record. Set ids with
+   DD_SINGLETON_BIT set are never defined, they stand for the single
+   label in their low bits.
+*/
+
+#ifndef __DD_LOGFORMAT_H
+#define __DD_LOGFORMAT_H
+
+#define DD_LOG_MAGIC     "DDLOG\0\0\5"
+#define DD_LOG_MAGIC_LEN 8
+
+#define DD_REC_SET       1
+#define DD_REC_SOURCE    2
+#define DD_REC_STORE     3
+#define DD_REC_RANGES    4
+#define DD_REC_PAGE      5
+#define DD_REC_NAME      6
+#define DD_REC_TAINTED   7
+
+#define DD_LABEL_PAGE_BITS 12
+
+#define DD_SINGLETON_BIT 0x80000000UL
+
+#endif
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -38,378 +38,3904 @@
 #include "pub_tool_libcbase.h"
 #include "pub_tool_options.h"
 #include "pub_tool_machine.h" 
-#include "vki/vki-scnums-x86-linux.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_aspacemgr.h"
+#include "pub_tool_vki.h"
+#include "pub_tool_vkiscnums.h"
 #include "pub_tool_threadstate.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_replacemalloc.h"
+
+#include "dd_logformat.h"
+#include "ddtector.h"
+
+// every byte of input is labelled by where it came from, a source and
+// an offset in it, so reading the same bytes again gives the same labels
+// (see LabelPage)
+typedef UInt Label;
+#define MAX_LABEL ((Label)0x7FFFFFFF)
+
+// provenance sets are immutable and hash-consed: every distinct set of
+// labels is stored once and named by a 32 bit id. id 0 is the empty set,
+// so an untainted location is simply a zero in the shadow. a set with a
+// single label is not stored at all, its id is the label with the top bit
+// set, so labelling the bytes of a read costs nothing but the shadow
+// writes.
+typedef UInt SetId;
+#define EMPTY_SET ((SetId)0)
+#define SINGLETON_BIT 0x80000000
+#define IS_SINGLETON(id) (((id) & SINGLETON_BIT) != 0)
+
+// small sets are kept as a sorted array of labels. once a set grows past
+// SMALL_SET_MAX labels it is stored as a sorted array of chunks, each a
+// bitmap over 256 consecutive labels, so the bytes of a buffer read by
+// the program cost one bit each and merging two sets is a word wise OR
+#define SMALL_SET_MAX 8
+#define CHUNK_SHIFT 8
+#define CHUNK_WORDS ((1 << CHUNK_SHIFT) / 64)
+
+typedef struct {
+  Label key;                // label >> CHUNK_SHIFT
+  ULong bits[CHUNK_WORDS];
+} LabelChunk;
+
+// a set is referenced by every shadow memory byte holding its id. sets
+// that drop to no references may still be held by a register shadow or
+// a temp, so they are only freed by sweep_sets, between blocks
+#define SET_MAYBE_DEAD 1    // on the maybe_dead list
+#define SET_PINNED     2    // seen in a register shadow by sweep_sets
+#define SET_LOGGED     4    // written to the binary log
+#define SET_RANGES     8    // stored as label ranges, see union_bounded
+#define SET_APPROX     16   // the ranges may hold labels not in the set
+#define SET_FORM       (SET_RANGES | SET_APPROX)
+
+// an inclusive range of labels
+typedef struct {
+  Label lo;
+  Label hi;
+} LabelRange;
+
+typedef struct LabelSet_ {
+  SetId id;
+  UInt hash;
+  UInt size;                // number of labels
+  UInt n_chunks;            // 0 when the labels are stored inline, the
+                            // number of ranges for SET_RANGES
+  UInt refs;                // shadow memory bytes holding this set
+  UInt flags;
+  struct LabelSet_* next;   // hash chain
+  ULong data[0];            // sorted labels, or chunks sorted by key
+} LabelSet;
+
+#define SET_LABELS(s) ((Label*)(s)->data)
+#define SET_CHUNKS(s) ((LabelChunk*)(s)->data)
+#define SET_RANGES_OF(s) ((LabelRange*)(s)->data)
+
+// id -> set, NULL for ids that are free
+static LabelSet** set_table;
+static UInt set_table_size;
+static UInt n_sets;         // ids handed out so far
+static UInt n_live_sets;
+
+// ids of freed sets, reused before new ones
+static SetId* free_ids;
+static UInt n_free_ids;
+static UInt free_ids_size;
+
+// sets that dropped to no references since the last sweep
+static SetId* maybe_dead;
+static UInt n_maybe_dead;
+static UInt maybe_dead_size;
+#define SWEEP_MIN 4096
+
+// set storage. sets are carved out of large blocks by size class, so
+// creating and dropping a set never goes through the tool's malloc, and
+// freeing every set at exit is freeing the blocks. sets too big for a
+// size class get a block of their own
+#define SLAB_BLOCK_SIZE (1 << 20)
+#define SLAB_GRAIN 16
+#define SLAB_MAX_OBJ 4096
+#define N_SLAB_CLASSES (SLAB_MAX_OBJ / SLAB_GRAIN + 1)
+
+typedef struct SlabBlock_ {
+  struct SlabBlock_* next;
+  struct SlabBlock_* prev;  // only kept for big blocks
+  ULong data[0];
+} SlabBlock;
+
+static SlabBlock* slab_blocks = NULL;  // blocks carved into sets
+static SlabBlock* big_blocks = NULL;   // one set each
+static UChar* slab_cur = NULL;
+static UChar* slab_end = NULL;
+static void* slab_free[N_SLAB_CLASSES];
+
+// contents -> set, used for interning
+static LabelSet** set_buckets;
+static UInt n_set_buckets;
+
+// memoized unions, (a, b) -> a U b with a < b. this is a direct mapped
+// cache so a miss only costs a merge and a lookup in the intern table
+#define UNION_CACHE_SIZE (1 << 16)
+
+typedef struct {
+  SetId a;
+  SetId b;
+  SetId res;
+} UnionEntry;
+
+static UnionEntry* union_cache;
+
+// unions that missed the cache, the labels of their operands and of
+// their results, and the unions answered by the cache, for --stats=yes
+// and --dd-stats
+static ULong n_unions = 0;
+static ULong n_labels_merged = 0;
+static ULong n_labels_kept = 0;
+static ULong n_union_hits = 0;
+
+// --dd-stats: counts of the shadow work done, printed at exit and, with
+// --dd-stats-interval, at the first thread switch after every N blocks.
+// the helpers count their own calls. register and memory shadows and
+// most unions are handled inline, with --dd-stats every one of those
+// also increments its counter inline, so they cost nothing otherwise
+static Bool clo_stats = False;
+static Int clo_stats_interval = 0;
+static ULong next_stats_dump = 0;
+
+typedef enum {
+  STAT_UNION_CALLS,     // dd_union
+  STAT_LOAD_CALLS,      // dd_load_shadow
+  STAT_STORE_CALLS,     // dd_store_tmp_to_addr
+  STAT_COPY_CALLS,      // dd_store_copy
+  STAT_CLEAR_CALLS,     // dd_clear_shadow
+  STAT_CLIENT_COPIES,   // client requests
+  STAT_CLIENT_CLEARS,
+  STAT_CLIENT_QUERIES,
+  STAT_REG_GETS,        // inline, only counted with --dd-stats
+  STAT_REG_PUTS,
+  STAT_MEM_LOADS,
+  STAT_MEM_STORES,
+  STAT_UNIONS,
+  N_STATS
+} Stat;
+
+static ULong stats[N_STATS];
+
+// --dd-profile: the helper calls and set unions of every guest function,
+// charged to the function of the block that made them. every block
+// stores the entry of its function in cur_fn when it starts; which one
+// that is is looked up once, when the block is translated. work done
+// before the first block runs goes to no_fn
+typedef struct FnProfile_ {
+  HChar* fnname;            // owned copies
+  HChar* objname;
+  ULong blocks;             // blocks run
+  ULong calls;              // helper calls and client requests
+  ULong unions;             // set unions that missed the cache
+  ULong labels;             // and the labels they merged
+  struct FnProfile_* next;  // hash chain
+} FnProfile;
+
+#define FN_BUCKETS 4096
+
+static Int clo_profile = 0;
+static HChar no_fn_name[] = "(no function)";
+static HChar no_fn_obj[] = "???";
+static FnProfile no_fn = { no_fn_name, no_fn_obj, 0, 0, 0, 0, NULL };
+static FnProfile* cur_fn = &no_fn;
+static FnProfile* fn_buckets[FN_BUCKETS];
+static UInt n_fns = 0;
+
+// a helper call or client request of kind 'k'
+static void count_call(Stat k){
+  stats[k]++;
+  cur_fn->calls++;
+}
+
+// translation time counts of the instrumentation skipped by
+// find_shadowed_tmps
+static ULong n_sbs_instrumented = 0;
+static ULong n_sbs_skipped = 0;
+static ULong n_helpers_elided = 0;
+static ULong n_shadow_loads_elided = 0;
+
+// scratch chunk arrays for building a set before interning it
+static LabelChunk* chunk_buf[3];
+static UInt chunk_buf_size[3];
+
+// the same for ranges and labels, used with --dd-max-labels
+static LabelRange* range_buf[3];
+static UInt range_buf_size[3];
+static Label* label_buf;
+static UInt label_buf_size;
+
+// --dd-max-labels, 0 when sets are unbounded
+static Int clo_max_labels = 0;
+
+static UInt popcount64(ULong w){
+  w = w - ((w >> 1) & 0x5555555555555555ULL);
+  w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+  w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (UInt)((w * 0x0101010101010101ULL) >> 56);
+}
+
+static UInt hash_words(UInt h, const ULong* words, UInt n){
+  for(UInt i = 0; i < n; i++){
+    h = (h ^ (UInt)words[i] ^ (UInt)(words[i] >> 32)) * 16777619u;
+  }
+  return h;
+}
+
+static UInt hash_labels(const Label* labels, UInt n){
+  UInt h = 2166136261u;
+  for(UInt i = 0; i < n; i++){
+    h = (h ^ labels[i]) * 16777619u;
+  }
+  return h;
+}
+
+static UInt hash_chunks(const LabelChunk* chunks, UInt n){
+  UInt h = 2166136261u;
+  for(UInt i = 0; i < n; i++){
+    ULong key = chunks[i].key;
+    h = hash_words(h, &key, 1);
+    h = hash_words(h, chunks[i].bits, CHUNK_WORDS);
+  }
+  return h;
+}
+
+static LabelSet* get_set(SetId id){
+  tl_assert(id < n_sets && set_table[id] != NULL);
+  return set_table[id];
+}
+
+// a singleton set has no LabelSet, this fills in 'tmp' for it
+typedef struct {
+  LabelSet s;
+  Label label;
+} SingletonSet;
+
+static LabelSet* get_any_set(SetId id, SingletonSet* tmp){
+  if(!IS_SINGLETON(id)){
+    return get_set(id);
+  }
+  tmp->s.id = id;
+  tmp->s.size = 1;
+  tmp->s.n_chunks = 0;
+  tmp->s.flags = 0;
+  SET_LABELS(&tmp->s)[0] = id & ~SINGLETON_BIT;
+  return &tmp->s;
+}
+
+static UInt set_size(SetId id){
+  if(id == EMPTY_SET){
+    return 0;
+  }
+  return IS_SINGLETON(id)? 1 : get_set(id)->size;
+}
+
+static void* slab_alloc(SizeT sz){
+  if(sz > SLAB_MAX_OBJ){
+    SlabBlock* b = VG_(malloc)("dd.slab_big", sizeof(SlabBlock) + sz);
+    b->next = big_blocks;
+    b->prev = NULL;
+    if(big_blocks != NULL){
+      big_blocks->prev = b;
+    }
+    big_blocks = b;
+    return b->data;
+  }
+
+  UInt c = (sz + SLAB_GRAIN - 1) / SLAB_GRAIN;
+  void* p = slab_free[c];
+  if(p != NULL){
+    slab_free[c] = *(void**)p;
+    return p;
+  }
+
+  sz = c * SLAB_GRAIN;
+  if(slab_cur + sz > slab_end){
+    SlabBlock* b = VG_(malloc)("dd.slab", SLAB_BLOCK_SIZE);
+    b->next = slab_blocks;
+    slab_blocks = b;
+    slab_cur = (UChar*)b->data;
+    slab_end = (UChar*)b + SLAB_BLOCK_SIZE;
+  }
+  p = slab_cur;
+  slab_cur += sz;
+  return p;
+}
+
+static void slab_release(void* p, SizeT sz){
+  if(sz > SLAB_MAX_OBJ){
+    SlabBlock* b = (SlabBlock*)((UChar*)p - sizeof(SlabBlock));
+    if(b->prev != NULL){
+      b->prev->next = b->next;
+    }
+    else{
+      big_blocks = b->next;
+    }
+    if(b->next != NULL){
+      b->next->prev = b->prev;
+    }
+    VG_(free)(b);
+    return;
+  }
+
+  UInt c = (sz + SLAB_GRAIN - 1) / SLAB_GRAIN;
+  *(void**)p = slab_free[c];
+  slab_free[c] = p;
+}
+
+// bytes of the representation of a set
+static SizeT set_data_bytes(UInt size, UInt n_chunks, UInt form){
+  if(form & SET_RANGES){
+    return n_chunks*sizeof(LabelRange);
+  }
+  return (n_chunks == 0)? size*sizeof(Label) : n_chunks*sizeof(LabelChunk);
+}
+
+static SizeT set_bytes(const LabelSet* s){
+  return sizeof(LabelSet) + set_data_bytes(s->size, s->n_chunks, s->flags & SET_FORM);
+}
+
+static void add_maybe_dead(LabelSet* s){
+  if(s->flags & SET_MAYBE_DEAD){
+    return;
+  }
+  if(n_maybe_dead == maybe_dead_size){
+    maybe_dead_size = (maybe_dead_size == 0)? 1024 : 2*maybe_dead_size;
+    maybe_dead = VG_(realloc)("dd.maybe_dead", maybe_dead, maybe_dead_size*sizeof(SetId));
+  }
+  maybe_dead[n_maybe_dead++] = s->id;
+  s->flags |= SET_MAYBE_DEAD;
+}
+
+// a shadow memory byte now holds 'id'. singletons are not stored, so
+// they are not counted
+static void ref_set(SetId id){
+  if(id != EMPTY_SET && !IS_SINGLETON(id)){
+    set_table[id]->refs++;
+  }
+}
+
+static void unref_set(SetId id){
+  if(id != EMPTY_SET && !IS_SINGLETON(id)){
+    LabelSet* s = set_table[id];
+    if(--s->refs == 0){
+      add_maybe_dead(s);
+    }
+  }
+}
+
+static LabelRange* get_range_buf(Int which, UInt n){
+  if(n > range_buf_size[which]){
+    range_buf_size[which] = (n > 2*range_buf_size[which])? n : 2*range_buf_size[which];
+    range_buf[which] = VG_(realloc)("dd.range_buf", range_buf[which],
+                                    range_buf_size[which]*sizeof(LabelRange));
+  }
+  return range_buf[which];
+}
+
+static Label* get_label_buf(UInt n){
+  if(n > label_buf_size){
+    label_buf_size = (n > 2*label_buf_size)? n : 2*label_buf_size;
+    label_buf = VG_(realloc)("dd.label_buf", label_buf, label_buf_size*sizeof(Label));
+  }
+  return label_buf;
+}
+
+static LabelChunk* get_chunk_buf(Int which, UInt n){
+  if(n > chunk_buf_size[which]){
+    chunk_buf_size[which] = (n > 2*chunk_buf_size[which])? n : 2*chunk_buf_size[which];
+    chunk_buf[which] = VG_(realloc)("dd.chunk_buf", chunk_buf[which],
+                                    chunk_buf_size[which]*sizeof(LabelChunk));
+  }
+  return chunk_buf[which];
+}
+
+static void init_sets(void){
+  set_table_size = 1024;
+  set_table = VG_(malloc)("dd.set_table", set_table_size*sizeof(LabelSet*));
+  // id 0 is reserved for the empty set
+  set_table[EMPTY_SET] = NULL;
+  n_sets = 1;
+
+  n_set_buckets = 1024;
+  set_buckets = VG_(calloc)("dd.set_buckets", n_set_buckets, sizeof(LabelSet*));
+
+  union_cache = VG_(calloc)("dd.union_cache", UNION_CACHE_SIZE, sizeof(UnionEntry));
+
+  for(Int i = 0; i < 3; i++){
+    chunk_buf_size[i] = 16;
+    chunk_buf[i] = VG_(malloc)("dd.chunk_buf", chunk_buf_size[i]*sizeof(LabelChunk));
+  }
+}
+
+// double the number of buckets once the table gets loaded
+static void grow_set_buckets(void){
+  UInt new_n = 2*n_set_buckets;
+  LabelSet** new_buckets = VG_(calloc)("dd.set_buckets", new_n, sizeof(LabelSet*));
+
+  for(UInt i = 0; i < n_set_buckets; i++){
+    LabelSet* s = set_buckets[i];
+    while(s != NULL){
+      LabelSet* next = s->next;
+      s->next = new_buckets[s->hash & (new_n-1)];
+      new_buckets[s->hash & (new_n-1)] = s;
+      s = next;
+    }
+  }
+  VG_(free)(set_buckets);
+  set_buckets = new_buckets;
+  n_set_buckets = new_n;
+}
+
+// find the set with this exact representation, or create it. 'data' is
+// either 'size' sorted labels (n_chunks == 0) or 'n_chunks' chunks, or
+// with SET_RANGES in 'form' 'n_chunks' sorted ranges
+static SetId intern_set(const void* data, UInt size, UInt n_chunks, UInt form){
+  if(size == 0){
+    return EMPTY_SET;
+  }
+
+  SizeT data_sz = set_data_bytes(size, n_chunks, form);
+  UInt h;
+  if(form & SET_RANGES){
+    h = hash_labels(data, 2*n_chunks) ^ form;
+  }
+  else{
+    h = (n_chunks == 0)? hash_labels(data, size) : hash_chunks(data, n_chunks);
+  }
+
+  LabelSet* s = set_buckets[h & (n_set_buckets-1)];
+  while(s != NULL){
+    if(s->hash == h && s->size == size && s->n_chunks == n_chunks
+       && (s->flags & SET_FORM) == form
+       && VG_(memcmp)(s->data, data, data_sz) == 0){
+      return s->id;
+    }
+    s = s->next;
+  }
+
+  if(n_live_sets >= n_set_buckets){
+    grow_set_buckets();
+  }
+
+  s = slab_alloc(sizeof(LabelSet) + data_sz);
+  if(n_free_ids > 0){
+    s->id = free_ids[--n_free_ids];
+  }
+  else{
+    if(n_sets == set_table_size){
+      set_table_size *= 2;
+      set_table = VG_(realloc)("dd.set_table", set_table,
+                               set_table_size*sizeof(LabelSet*));
+    }
+    s->id = n_sets++;
+  }
+  n_live_sets++;
+  s->hash = h;
+  s->size = size;
+  s->n_chunks = n_chunks;
+  s->refs = 0;
+  s->flags = form;
+  VG_(memcpy)(s->data, data, data_sz);
+  s->next = set_buckets[h & (n_set_buckets-1)];
+  set_buckets[h & (n_set_buckets-1)] = s;
+  set_table[s->id] = s;
+
+  // nothing holds the new set yet
+  add_maybe_dead(s);
+
+  return s->id;
+}
+
+// convert sorted labels to chunks, returns the number of chunks
+static UInt labels_to_chunks(const Label* labels, UInt n, Int which){
+  LabelChunk* out = get_chunk_buf(which, n);
+  UInt n_out = 0;
+
+  for(UInt i = 0; i < n; i++){
+    Label key = labels[i] >> CHUNK_SHIFT;
+    UInt bit = labels[i] & ((1 << CHUNK_SHIFT) - 1);
+    if(n_out == 0 || out[n_out-1].key != key){
+      out[n_out].key = key;
+      VG_(memset)(out[n_out].bits, 0, sizeof(out[n_out].bits));
+      n_out++;
+    }
+    out[n_out-1].bits[bit / 64] |= 1ULL << (bit % 64);
+  }
+  return n_out;
+}
+
+static SetId singleton_set(Label label){
+  return SINGLETON_BIT | label;
+}
+
+// intern a set given as sorted labels, picking the representation
+static SetId intern_labels(const Label* labels, UInt n){
+  if(n == 1){
+    return singleton_set(labels[0]);
+  }
+  if(n <= SMALL_SET_MAX){
+    return intern_set(labels, n, 0, 0);
+  }
+  UInt n_chunks = labels_to_chunks(labels, n, 2);
+  return intern_set(chunk_buf[2], n, n_chunks, 0);
+}
+
+// the chunks of a set, converting small sets into scratch buffer 'which'
+static const LabelChunk* set_chunks(LabelSet* s, Int which, UInt* n_chunks){
+  if(s->n_chunks != 0){
+    *n_chunks = s->n_chunks;
+    return SET_CHUNKS(s);
+  }
+  *n_chunks = labels_to_chunks(SET_LABELS(s), s->size, which);
+  return chunk_buf[which];
+}
+
+// merge two small sets, these are short enough for a plain array merge
+static SetId union_small_sets(LabelSet* sa, LabelSet* sb){
+  Label buf[2*SMALL_SET_MAX];
+  Label* la = SET_LABELS(sa);
+  Label* lb = SET_LABELS(sb);
+
+  UInt i = 0, j = 0, n = 0;
+  while(i < sa->size && j < sb->size){
+    if(la[i] < lb[j]){
+      buf[n++] = la[i++];
+    }
+    else if(la[i] > lb[j]){
+      buf[n++] = lb[j++];
+    }
+    else{
+      buf[n++] = la[i++];
+      j++;
+    }
+  }
+  while(i < sa->size){
+    buf[n++] = la[i++];
+  }
+  while(j < sb->size){
+    buf[n++] = lb[j++];
+  }
+
+  return intern_labels(buf, n);
+}
+
+// merge two sets where at least one is large. chunks with the same key
+// are ORed a word at a time
+static SetId union_large_sets(LabelSet* sa, LabelSet* sb){
+  UInt na, nb;
+  const LabelChunk* ca = set_chunks(sa, 0, &na);
+  const LabelChunk* cb = set_chunks(sb, 1, &nb);
+  LabelChunk* out = get_chunk_buf(2, na + nb);
+
+  UInt i = 0, j = 0, n = 0, size = 0;
+  while(i < na || j < nb){
+    if(j == nb || (i < na && ca[i].key < cb[j].key)){
+      out[n] = ca[i++];
+    }
+    else if(i == na || cb[j].key < ca[i].key){
+      out[n] = cb[j++];
+    }
+    else{
+      out[n].key = ca[i].key;
+      for(Int w = 0; w < CHUNK_WORDS; w++){
+        out[n].bits[w] = ca[i].bits[w] | cb[j].bits[w];
+      }
+      i++;
+      j++;
+    }
+    for(Int w = 0; w < CHUNK_WORDS; w++){
+      size += popcount64(out[n].bits[w]);
+    }
+    n++;
+  }
+
+  return intern_set(out, size, n, 0);
+}
+
+static void add_label_to_ranges(LabelRange* r, UInt* n, Label l){
+  if(*n > 0 && r[*n-1].hi + 1 == l){
+    r[*n-1].hi = l;
+  }
+  else{
+    r[*n].lo = r[*n].hi = l;
+    (*n)++;
+  }
+}
+
+// the labels of a set as sorted ranges, converting other forms into
+// scratch buffer 'which'
+static const LabelRange* set_ranges(LabelSet* s, Int which, UInt* n_ranges){
+  if(s->flags & SET_RANGES){
+    *n_ranges = s->n_chunks;
+    return SET_RANGES_OF(s);
+  }
+
+  LabelRange* out = get_range_buf(which, s->size);
+  UInt n = 0;
+  if(s->n_chunks == 0){
+    for(UInt i = 0; i < s->size; i++){
+      add_label_to_ranges(out, &n, SET_LABELS(s)[i]);
+    }
+  }
+  else{
+    for(UInt i = 0; i < s->n_chunks; i++){
+      LabelChunk* c = &SET_CHUNKS(s)[i];
+      for(Int w = 0; w < CHUNK_WORDS; w++){
+        ULong bits = c->bits[w];
+        while(bits != 0){
+          add_label_to_ranges(out, &n, (c->key << CHUNK_SHIFT) + 64*w + __builtin_ctzll(bits));
+          bits &= bits - 1;
+        }
+      }
+    }
+  }
+  *n_ranges = n;
+  return out;
+}
+
+static Int cmp_gaps(const void* a, const void* b){
+  UInt x = *(const UInt*)a, y = *(const UInt*)b;
+  return (x < y)? -1 : (x > y)? 1 : 0;
+}
+
+// join the ranges separated by the smallest gaps until only 'max' are
+// left, returns the new number of ranges
+static UInt join_closest_ranges(LabelRange* r, UInt n, UInt max){
+  UInt* gaps = VG_(malloc)("dd.gaps", (n-1)*sizeof(UInt));
+  for(UInt i = 0; i+1 < n; i++){
+    gaps[i] = r[i+1].lo - r[i].hi;
+  }
+  VG_(ssort)(gaps, n-1, sizeof(UInt), cmp_gaps);
+
+  // every gap below 'limit' is joined, and as many gaps equal to it as
+  // are still needed
+  UInt limit = gaps[n - max - 1];
+  UInt n_equal = n - max;
+  for(UInt i = 0; i < n - max && gaps[i] < limit; i++){
+    n_equal--;
+  }
+  VG_(free)(gaps);
+
+  UInt m = 1;
+  Label prev_hi = r[0].hi;
+  for(UInt i = 1; i < n; i++){
+    UInt gap = r[i].lo - prev_hi;
+    prev_hi = r[i].hi;
+    if(gap < limit || (gap == limit && n_equal > 0)){
+      if(gap == limit){
+        n_equal--;
+      }
+      r[m-1].hi = r[i].hi;
+    }
+    else{
+      r[m++] = r[i];
+    }
+  }
+  return m;
+}
+
+// with --dd-max-labels=N a set of more than N labels is kept as at most N
+// label ranges. when there would be more, the ranges with the smallest
+// gaps between them are joined, which adds labels that are not really in
+// the set, and the set is marked approximate. a union then costs at most
+// a merge of two lists of N ranges, however many labels are involved
+static SetId union_bounded(LabelSet* sa, LabelSet* sb){
+  UInt na, nb;
+  const LabelRange* ra = set_ranges(sa, 0, &na);
+  const LabelRange* rb = set_ranges(sb, 1, &nb);
+  LabelRange* out = get_range_buf(2, na + nb);
+
+  UInt i = 0, j = 0, n = 0;
+  while(i < na || j < nb){
+    LabelRange r = (j == nb || (i < na && ra[i].lo <= rb[j].lo))? ra[i++] : rb[j++];
+    if(n > 0 && r.lo <= out[n-1].hi + 1){
+      if(r.hi > out[n-1].hi){
+        out[n-1].hi = r.hi;
+      }
+    }
+    else{
+      out[n++] = r;
+    }
+  }
+
+  UInt form = SET_RANGES | ((sa->flags | sb->flags) & SET_APPROX);
+  if(n > clo_max_labels){
+    n = join_closest_ranges(out, n, clo_max_labels);
+    form |= SET_APPROX;
+  }
+
+  UInt size = 0;
+  for(i = 0; i < n; i++){
+    size += out[i].hi - out[i].lo + 1;
+  }
+
+  // few enough labels to be exact again
+  if(!(form & SET_APPROX) && size <= clo_max_labels){
+    Label* labels = get_label_buf(size);
+    UInt k = 0;
+    for(i = 0; i < n; i++){
+      for(Label l = out[i].lo; l <= out[i].hi; l++){
+        labels[k++] = l;
+      }
+    }
+    return intern_labels(labels, size);
+  }
+
+  return intern_set(out, size, n, form);
+}
+
+// a U b, the result is remembered so repeating the same merge is a
+// single lookup
+static SetId union_sets(SetId a, SetId b){
+  if(a == b || b == EMPTY_SET){
+    return a;
+  }
+  if(a == EMPTY_SET){
+    return b;
+  }
+  if(a > b){
+    SetId t = a; a = b; b = t;
+  }
+
+  UnionEntry* e = &union_cache[((a*0x9E3779B1u) ^ b) & (UNION_CACHE_SIZE-1)];
+  if(e->a == a && e->b == b){
+    n_union_hits++;
+    return e->res;
+  }
+
+  SingletonSet tmp_a, tmp_b;
+  LabelSet* sa = get_any_set(a, &tmp_a);
+  LabelSet* sb = get_any_set(b, &tmp_b);
+  SetId res;
+
+  n_unions++;
+  n_labels_merged += sa->size + sb->size;
+  cur_fn->unions++;
+  cur_fn->labels += sa->size + sb->size;
+  if(clo_max_labels != 0 && (((sa->flags | sb->flags) & SET_RANGES)
+                              || sa->size + sb->size > clo_max_labels)){
+    res = union_bounded(sa, sb);
+  }
+  else if(sa->n_chunks == 0 && sb->n_chunks == 0){
+    res = union_small_sets(sa, sb);
+  }
+  else{
+    res = union_large_sets(sa, sb);
+  }
+  n_labels_kept += IS_SINGLETON(res)? 1 : get_set(res)->size;
+
+  e->a = a;
+  e->b = b;
+  e->res = res;
+  return res;
+}
+
+// call 'f' on every label of a set in increasing order
+static void for_each_label(SetId id, void (*f)(Label)){
+  if(id == EMPTY_SET){
+    return;
+  }
+
+  SingletonSet tmp;
+  LabelSet* s = get_any_set(id, &tmp);
+
+  if(s->flags & SET_RANGES){
+    for(UInt i = 0; i < s->n_chunks; i++){
+      for(Label l = SET_RANGES_OF(s)[i].lo; l <= SET_RANGES_OF(s)[i].hi; l++){
+        f(l);
+      }
+    }
+    return;
+  }
+
+  if(s->n_chunks == 0){
+    for(UInt i = 0; i < s->size; i++){
+      f(SET_LABELS(s)[i]);
+    }
+    return;
+  }
+
+  for(UInt i = 0; i < s->n_chunks; i++){
+    LabelChunk* c = &SET_CHUNKS(s)[i];
+    for(Int w = 0; w < CHUNK_WORDS; w++){
+      ULong bits = c->bits[w];
+      while(bits != 0){
+        Int bit = __builtin_ctzll(bits);
+        f((c->key << CHUNK_SHIFT) + 64*w + bit);
+        bits &= bits - 1;
+      }
+    }
+  }
+}
+
+// drop a set that nothing refers to any more
+static void release_set(LabelSet* s){
+  LabelSet** p = &set_buckets[s->hash & (n_set_buckets-1)];
+  while(*p != s){
+    p = &(*p)->next;
+  }
+  *p = s->next;
+
+  if(n_free_ids == free_ids_size){
+    free_ids_size = (free_ids_size == 0)? 1024 : 2*free_ids_size;
+    free_ids = VG_(realloc)("dd.free_ids", free_ids, free_ids_size*sizeof(SetId));
+  }
+  free_ids[n_free_ids++] = s->id;
+  set_table[s->id] = NULL;
+  n_live_sets--;
+  slab_release(s, set_bytes(s));
+}
+
+static Bool is_freed(SetId id){
+  return id != EMPTY_SET && !IS_SINGLETON(id) && set_table[id] == NULL;
+}
+
+// keep a maybe dead set whose id was found in a register shadow. the
+// caller scans the raw shadow bytes, so 'id' may be any value
+static void pin_set(SetId id){
+  if(id != EMPTY_SET && !IS_SINGLETON(id) && id < n_sets && set_table[id] != NULL
+     && (set_table[id]->flags & SET_MAYBE_DEAD)){
+    set_table[id]->flags |= SET_PINNED;
+  }
+}
+
+// free the sets on the maybe_dead list that are still unreferenced. this
+// must run between blocks, when no temp holds a set, and after pin_set
+// was called on every id in the register shadows
+static void sweep_sets(void){
+  UInt kept = 0, freed = 0;
+
+  for(UInt i = 0; i < n_maybe_dead; i++){
+    LabelSet* s = set_table[maybe_dead[i]];
+    if(s->refs == 0 && !(s->flags & SET_PINNED)){
+      release_set(s);
+      freed++;
+      continue;
+    }
+    s->flags &= ~(SET_MAYBE_DEAD | SET_PINNED);
+    if(s->refs == 0){
+      // only a register holds it, look again next time
+      s->flags |= SET_MAYBE_DEAD;
+      maybe_dead[kept++] = s->id;
+    }
+  }
+  n_maybe_dead = kept;
+
+  // forget the unions that mention a freed id, the id may be reused
+  if(freed > 0){
+    for(UInt i = 0; i < UNION_CACHE_SIZE; i++){
+      UnionEntry* e = &union_cache[i];
+      if(is_freed(e->a) || is_freed(e->b) || is_freed(e->res)){
+        e->a = e->b = e->res = EMPTY_SET;
+      }
+    }
+  }
+}
+
+// free every interned set, by dropping the blocks they live in
+static void free_sets(void){
+  while(slab_blocks != NULL){
+    SlabBlock* b = slab_blocks;
+    slab_blocks = b->next;
+    VG_(free)(b);
+  }
+  while(big_blocks != NULL){
+    SlabBlock* b = big_blocks;
+    big_blocks = b->next;
+    VG_(free)(b);
+  }
+  VG_(free)(set_table);
+  VG_(free)(free_ids);
+  VG_(free)(maybe_dead);
+  VG_(free)(set_buckets);
+  VG_(free)(union_cache);
+  for(Int i = 0; i < 3; i++){
+    VG_(free)(chunk_buf[i]);
+    VG_(free)(range_buf[i]);
+  }
+  VG_(free)(label_buf);
+}
+
+
+
+// with --dd-granularity=N one shadow entry, a cell, covers N aligned
+// bytes. the maps are indexed by cell number, addr >> gran_shift, so a
+// coarse granularity shrinks the shadow and the number of merges by N
+static Int clo_granularity = 1;
+static UInt gran_shift = 0;
+#define CELL(a) ((Addr)(a) >> gran_shift)
+
+typedef struct {
+  HChar* buf;       // the list, with its commas replaced by NULs
+  HChar** pats;
+  UInt n;
+} GlobList;
+
+static void parse_globs(const HChar* list, GlobList* l){
+  if(list == NULL){
+    return;
+  }
+  l->buf = VG_(strdup)("dd.globs", list);
+  l->n = 1;
+  for(HChar* c = l->buf; *c; c++){
+    l->n += (*c == ',');
+  }
+  l->pats = VG_(malloc)("dd.globs", l->n*sizeof(HChar*));
+  l->n = 0;
+  HChar* save;
+  for(HChar* p = VG_(strtok_r)(l->buf, ",", &save); p != NULL;
+      p = VG_(strtok_r)(NULL, ",", &save)){
+    l->pats[l->n++] = p;
+  }
+}
+
+static Bool match_globs(const GlobList* l, const HChar* name){
+  for(UInt i = 0; i < l->n; i++){
+    if(VG_(string_match)(l->pats[i], name)){
+      return True;
+    }
+  }
+  return False;
+}
+
+static void free_globs(GlobList* l){
+  if(l->buf != NULL){
+    VG_(free)(l->buf);
+    VG_(free)(l->pats);
+  }
+}
+
+// a source is whatever a file descriptor was opened on: a file, a pipe,
+// a socket or a terminal, named by its /proc/self/fd link, so opening
+// the same file again gives the same source. ids start at 1
+typedef struct {
+  HChar* name;
+  Bool selected;            // matched by --dd-sources
+  Bool announced;           // its name was reported
+  UInt next;                // hash chain
+} Source;
+
+#define SOURCE_BUCKETS 1024
+
+static Source* sources = NULL;
+static UInt n_sources = 1;
+static UInt sources_size = 0;
+static UInt source_buckets[SOURCE_BUCKETS];
+
+// --dd-sources, the sources whose input is labelled, all by default
+static const HChar* clo_sources = NULL;
+// --dd-mmap, whether files mapped into memory are input too
+static Bool clo_mmap = False;
+static GlobList source_globs;
+
+static UInt get_source(const HChar* name){
+  UInt h = 2166136261u;
+  for(const HChar* c = name; *c; c++){
+    h = (h ^ (UChar)*c) * 16777619u;
+  }
+  UInt* b = &source_buckets[h & (SOURCE_BUCKETS-1)];
+  for(UInt id = *b; id != 0; id = sources[id].next){
+    if(VG_(strcmp)(sources[id].name, name) == 0){
+      return id;
+    }
+  }
+
+  if(n_sources >= sources_size){
+    sources_size = (sources_size == 0)? 64 : 2*sources_size;
+    sources = VG_(realloc)("dd.sources", sources, sources_size*sizeof(Source));
+  }
+  Source* src = &sources[n_sources];
+  src->name = VG_(strdup)("dd.sources.name", name);
+  src->selected = source_globs.n == 0 || match_globs(&source_globs, name);
+  src->announced = False;
+  src->next = *b;
+  *b = n_sources;
+  return n_sources++;
+}
+
+// what we know about an open file descriptor: its source, found when it
+// is first read, and the offset of the next byte a read gets. for pipes
+// and sockets that is the number of bytes read so far
+typedef struct {
+  UInt source;              // 0 until known
+  ULong pos;
+} FdState;
+
+#define MAX_FDS (1 << 20)
+
+static FdState* fds = NULL;
+static Int fds_size = 0;
+
+static FdState* get_fd(Int fd){
+  if(fd < 0 || fd >= MAX_FDS){
+    return NULL;
+  }
+  if(fd >= fds_size){
+    Int new_size = (fd >= 2*fds_size)? fd + 1 : 2*fds_size;
+    fds = VG_(realloc)("dd.fds", fds, new_size*sizeof(FdState));
+    VG_(memset)(fds + fds_size, 0, (new_size - fds_size)*sizeof(FdState));
+    fds_size = new_size;
+  }
+  return &fds[fd];
+}
+
+// a descriptor was opened, or closed
+static void reset_fd(Int fd){
+  FdState* f = get_fd(fd);
+  if(f != NULL){
+    f->source = 0;
+    f->pos = 0;
+  }
+}
+
+// dup and friends. the copy shares the source, the offset is only
+// shared until either is read
+static void copy_fd(Int from, Int to){
+  FdState* f = get_fd(from);
+  FdState* t = get_fd(to);
+  if(f != NULL && t != NULL){
+    *t = *f;
+  }
+}
+
+static UInt fd_source(FdState* f, Int fd){
+  if(f->source == 0){
+    HChar link[64];
+    HChar name[256];
+    VG_(sprintf)(link, "/proc/self/fd/%d", fd);
+    Int n = VG_(readlink)(link, name, sizeof(name) - 1);
+    if(n > 0){
+      name[n] = 0;
+    }
+    else{
+      VG_(sprintf)(name, "fd %d", fd);
+    }
+    f->source = get_source(name);
+  }
+  return f->source;
+}
+
+// labels are handed out a page of input at a time: the cells of the
+// 1 << DD_LABEL_PAGE_BITS bytes of a source starting at offset
+// page << DD_LABEL_PAGE_BITS get consecutive labels, the first cell of
+// the n'th page handed out getting label n << page_label_bits. a label
+// is turned back into its source and offset through label_pages
+typedef struct {
+  UInt source;
+  ULong page;
+} LabelPage;
+
+static LabelPage* label_pages = NULL;
+static UInt n_label_pages = 0;
+static UInt label_pages_size = 0;
+
+// (source, page) -> index in label_pages + 1, open addressing
+static UInt* page_table = NULL;
+static UInt page_table_size = 0;
+
+// log2 of the labels of a page, DD_LABEL_PAGE_BITS - gran_shift
+static UInt page_label_bits;
+
+static UInt page_hash(UInt source, ULong page){
+  return (source*0x9E3779B1u) ^ (UInt)(page*0x85EBCA6Bu) ^ (UInt)(page >> 32);
+}
+
+static void grow_page_table(void){
+  UInt old_size = page_table_size;
+  UInt* old = page_table;
+  page_table_size = (old_size == 0)? 1024 : 2*old_size;
+  page_table = VG_(calloc)("dd.page_table", page_table_size, sizeof(UInt));
+  for(UInt i = 0; i < old_size; i++){
+    if(old[i] != 0){
+      LabelPage* p = &label_pages[old[i] - 1];
+      UInt h = page_hash(p->source, p->page) & (page_table_size-1);
+      while(page_table[h] != 0){
+        h = (h + 1) & (page_table_size-1);
+      }
+      page_table[h] = old[i];
+    }
+  }
+  VG_(free)(old);
+}
+
+// the label of the cell at 'offset' in 'source', or False once all labels
+// are used up
+static Bool get_label(UInt source, ULong offset, Label* l){
+  static Bool warned = False;
+  ULong page = offset >> DD_LABEL_PAGE_BITS;
+
+  if(2*(n_label_pages + 1) > page_table_size){
+    grow_page_table();
+  }
+  UInt h = page_hash(source, page) & (page_table_size-1);
+  while(page_table[h] != 0){
+    LabelPage* p = &label_pages[page_table[h] - 1];
+    if(p->source == source && p->page == page){
+      break;
+    }
+    h = (h + 1) & (page_table_size-1);
+  }
+
+  if(page_table[h] == 0){
+    if(n_label_pages >= (MAX_LABEL >> page_label_bits)){
+      if(!warned){
+        VG_(umsg)("warning: out of labels, further input is not tracked\n");
+        warned = True;
+      }
+      return False;
+    }
+    if(n_label_pages == label_pages_size){
+      label_pages_size = (label_pages_size == 0)? 256 : 2*label_pages_size;
+      label_pages = VG_(realloc)("dd.label_pages", label_pages,
+                                 label_pages_size*sizeof(LabelPage));
+    }
+    label_pages[n_label_pages].source = source;
+    label_pages[n_label_pages].page = page;
+    page_table[h] = ++n_label_pages;
+  }
+
+  *l = ((page_table[h] - 1) << page_label_bits)
+       + ((offset & ((1 << DD_LABEL_PAGE_BITS) - 1)) >> gran_shift);
+  return True;
+}
+
+static UInt label_source(Label l){
+  return label_pages[l >> page_label_bits].source;
+}
+
+// the offset of the first byte of the cell a label stands for
+static ULong label_offset(Label l){
+  return (label_pages[l >> page_label_bits].page << DD_LABEL_PAGE_BITS)
+         + ((ULong)(l & ((1 << page_label_bits) - 1)) << gran_shift);
+}
+
+static void free_sources(void){
+  for(UInt i = 1; i < n_sources; i++){
+    VG_(free)(sources[i].name);
+  }
+  VG_(free)(sources);
+  VG_(free)(fds);
+  VG_(free)(label_pages);
+  VG_(free)(page_table);
+  free_globs(&source_globs);
+}
+
+
+// shadow memory is a three level map in the style of memcheck. a secondary
+// map covers 4KB of guest memory with one set id per byte. all the maps
+// start out pointing at a single distinguished secondary that is all
+// EMPTY_SET and never written; it is replaced by a private copy the first
+// time a byte in its range gets tainted, so reads never need a NULL check
+// and memory use follows the number of tainted pages. a secondary whose
+// bytes are all cleared again is freed (see release_sm).
+#define SM_BITS 12
+#define SM_SIZE (1 << SM_BITS)
+#define MID_BITS 16
+#define MID_SIZE (1 << MID_BITS)
+#if VG_WORDSIZE == 8
+#define PRIMARY_BITS 20   // 48 bit user address space
+#else
+#define PRIMARY_BITS 4
+#endif
+#define PRIMARY_SIZE (1 << PRIMARY_BITS)
+
+#if VG_WORDSIZE == 8
+// addresses above the user address space (the vsyscall page) are never tainted
+#define IS_SHADOWED(a) (((a) >> (PRIMARY_BITS + MID_BITS + SM_BITS)) == 0)
+#else
+#define IS_SHADOWED(a) True
+#endif
+
+typedef struct {
+  SetId ids[SM_SIZE];
+  UInt n_tainted;           // bytes that are not EMPTY_SET
+} SecMap;
+
+typedef struct {
+  SecMap* sm[MID_SIZE];
+  UInt n_private;           // secondaries that are not clean_sm
+} MidMap;
+
+// with --dd-mode=bool a secondary holds one bit per cell instead of a
+// set id, whether it is tainted. it covers the same SM_SIZE cells, so the
+// maps above are shared, and clean_sm reads as all clear in either mode.
+// the instrumented code reads and writes the bits a host word at a time
+// from the byte of the first cell on, the padding keeps that inside the
+// secondary
+typedef struct {
+  UChar bits[SM_SIZE/8];
+  UChar pad[sizeof(ULong)];
+} BitSecMap;
+
+static Bool bool_mode = False;
+
+static SecMap clean_sm;
+static MidMap clean_mid;
+static MidMap* primary_map[PRIMARY_SIZE];
+
+// ananlysis variables
+static Bool trace = False; // input is labelled and stores reported
+
+// --dd-trace=client: tracing is started and stopped only by the
+// VALGRIND_DD_START and VALGRIND_DD_STOP client requests
+static Bool trace_by_client = False;
+
+// entries of main and exit, which start and stop tracing. these are 0
+// until the first translation that reaches them
+static Addr trace_start_addr = 0;
+static Addr trace_stop_addr = 0;
+
+// non zero once anything is tainted. it is cleared again when memory
+// and all register shadows are empty (see update_taint_present)
+static UInt taint_present = 0;
+static ULong n_tainted_bytes = 0;   // tainted cells, really
+static ULong n_private_sms = 0;     // secondaries that are not clean_sm
+static ULong n_sm_allocs = 0;       // and ever allocated, for --dd-stats
+static ULong peak_private_sms = 0;
+
+// every helper call in the instrumented code is gated on this, so nothing
+// but a load and a branch runs before the first source is read. taint is
+// propagated whether or not we are tracing, so shadow memory stays right
+// for queries and later windows; tracing only decides what is labelled
+// and reported
+static UInt helpers_on = 0;
+
+static void update_helpers_on(void){
+  helpers_on = taint_present;
+}
+
+// aditional instrumentation functions
+
+static void init_shadow_mem(void){
+  for(UInt i = 0; i < MID_SIZE; i++){
+    clean_mid.sm[i] = &clean_sm;
+  }
+  for(UInt i = 0; i < PRIMARY_SIZE; i++){
+    primary_map[i] = &clean_mid;
+  }
+}
+
+static void free_shadow_mem(void){
+  for(UInt i = 0; i < PRIMARY_SIZE; i++){
+    MidMap* mid = primary_map[i];
+    if(mid == &clean_mid){
+      continue;
+    }
+    for(UInt j = 0; j < MID_SIZE; j++){
+      if(mid->sm[j] != &clean_sm){
+        VG_(free)(mid->sm[j]);
+      }
+    }
+    VG_(free)(mid);
+    primary_map[i] = &clean_mid;
+  }
+}
+
+static SecMap* get_sm(Addr addr){
+  MidMap* mid = primary_map[(addr >> (MID_BITS + SM_BITS)) & (PRIMARY_SIZE-1)];
+  return mid->sm[(addr >> SM_BITS) & (MID_SIZE-1)];
+}
+
+// the secondary for 'addr', replacing the clean maps on the way down
+static SecMap* get_sm_for_writing(Addr addr){
+  MidMap** mid = &primary_map[(addr >> (MID_BITS + SM_BITS)) & (PRIMARY_SIZE-1)];
+  if(*mid == &clean_mid){
+    *mid = VG_(malloc)("dd.mid_map", sizeof(MidMap));
+    VG_(memcpy)(*mid, &clean_mid, sizeof(MidMap));
+  }
+
+  SecMap** sm = &(*mid)->sm[(addr >> SM_BITS) & (MID_SIZE-1)];
+  if(*sm == &clean_sm){
+    *sm = VG_(calloc)("dd.sec_map", 1, bool_mode? sizeof(BitSecMap) : sizeof(SecMap));
+    (*mid)->n_private++;
+    n_sm_allocs++;
+    if(++n_private_sms > peak_private_sms){
+      peak_private_sms = n_private_sms;
+    }
+  }
+  return *sm;
+}
+
+// give the secondary for 'addr', which has nothing tainted any more, back
+// to clean_sm, and its mid map to clean_mid once that has no private
+// secondaries left
+static void release_sm(Addr addr){
+  MidMap** mid = &primary_map[(addr >> (MID_BITS + SM_BITS)) & (PRIMARY_SIZE-1)];
+  SecMap** sm = &(*mid)->sm[(addr >> SM_BITS) & (MID_SIZE-1)];
+  tl_assert(*sm != &clean_sm && (bool_mode || (*sm)->n_tainted == 0));
+
+  VG_(free)(*sm);
+  *sm = &clean_sm;
+  n_private_sms--;
+  if(--(*mid)->n_private == 0){
+    VG_(free)(*mid);
+    *mid = &clean_mid;
+  }
+}
+
+// is any cell of memory tainted? bool mode sets bits inline without
+// counting them, there it is whether any secondary is private
+static Bool mem_tainted(void){
+  return bool_mode? n_private_sms != 0 : n_tainted_bytes != 0;
+}
+
+// the set of cell 'c'
+static SetId get_cell(Addr c){
+  if(!IS_SHADOWED(c)){
+    return EMPTY_SET;
+  }
+  return get_sm(c)->ids[c & (SM_SIZE-1)];
+}
+
+// make 'id' the set of cell 'c'
+static void put_cell(Addr c, SetId id){
+  if(!IS_SHADOWED(c)){
+    return;
+  }
+  SecMap* sm = get_sm(c);
+  SetId old = sm->ids[c & (SM_SIZE-1)];
+  if(old == id){
+    return;
+  }
+  if(sm == &clean_sm){
+    sm = get_sm_for_writing(c);
+  }
+
+  ref_set(id);
+  unref_set(old);
+  sm->ids[c & (SM_SIZE-1)] = id;
+  if(old == EMPTY_SET){
+    n_tainted_bytes++;
+    sm->n_tainted++;
+    taint_present = 1;
+    update_helpers_on();
+  }
+  else if(id == EMPTY_SET){
+    n_tainted_bytes--;
+    if(--sm->n_tainted == 0){
+      release_sm(c);
+    }
+  }
+}
+
+// get the set of addresses which taints 'addr'
+static SetId get_shadow_mem(Addr addr){
+  return get_cell(CELL(addr));
+}
+
+// add the set 'tainted_by' to the taint of the 'size' bytes at 'addr'
+static void set_shadow_mem(Addr addr, SizeT size, SetId tainted_by){
+  //VG_(printf)("setting shadow mem for %lx as tainted by %x\n",addr, tainted_by);
+  if(tainted_by == EMPTY_SET || size == 0){
+    return;
+  }
+  for(Addr c = CELL(addr); c <= CELL(addr + size - 1); c++){
+    put_cell(c, union_sets(get_cell(c), tainted_by));
+  }
+}
+
+// bool mode. only whether a cell is tainted is kept
+
+static UInt get_bit(Addr c){
+  if(!IS_SHADOWED(c)){
+    return 0;
+  }
+  UInt i = c & (SM_SIZE-1);
+  return (((BitSecMap*)get_sm(c))->bits[i >> 3] >> (i & 7)) & 1;
+}
+
+// give the bit secondary of cell 'c' back if no bit in it is set
+static void maybe_release_bits(Addr c){
+  const ULong* w = (const ULong*)((BitSecMap*)get_sm(c))->bits;
+  for(UInt i = 0; i < SM_SIZE/64; i++){
+    if(w[i] != 0){
+      return;
+    }
+  }
+  release_sm(c);
+}
+
+static void put_bit(Addr c, UInt v){
+  if(!IS_SHADOWED(c)){
+    return;
+  }
+  UInt i = c & (SM_SIZE-1);
+  SecMap* sm = get_sm(c);
+  if(v){
+    if(sm == &clean_sm){
+      sm = get_sm_for_writing(c);
+    }
+    ((BitSecMap*)sm)->bits[i >> 3] |= 1 << (i & 7);
+    taint_present = 1;
+    update_helpers_on();
+  }
+  else if(sm != &clean_sm){
+    UChar* b = &((BitSecMap*)sm)->bits[i >> 3];
+    *b &= ~(1 << (i & 7));
+    if(*b == 0){
+      maybe_release_bits(c);
+    }
+  }
+}
+
+// set (v == 1) or clear the bits of the cells [c, c+n), a secondary at a
+// time
+static void fill_bits(Addr c, Addr n, UInt v){
+  while(n > 0 && IS_SHADOWED(c)){
+    UInt off = c & (SM_SIZE-1);
+    UInt k = (n < SM_SIZE - off)? n : SM_SIZE - off;
+    SecMap* sm = get_sm(c);
+
+    if(v || sm != &clean_sm){
+      if(sm == &clean_sm){
+        sm = get_sm_for_writing(c);
+      }
+      UChar* bits = ((BitSecMap*)sm)->bits;
+      for(UInt i = off; i < off + k; i++){
+        if(v){
+          bits[i >> 3] |= 1 << (i & 7);
+        }
+        else{
+          bits[i >> 3] &= ~(1 << (i & 7));
+        }
+      }
+      if(!v){
+        maybe_release_bits(c);
+      }
+    }
+
+    c += k;
+    n -= k;
+  }
+
+  if(v){
+    taint_present = 1;
+    update_helpers_on();
+  }
+}
+
+// tainted cells of all of memory, for the summary at exit
+static ULong count_bits(void){
+  ULong n = 0;
+  for(UInt i = 0; i < PRIMARY_SIZE; i++){
+    MidMap* mid = primary_map[i];
+    if(mid == &clean_mid){
+      continue;
+    }
+    for(UInt j = 0; j < MID_SIZE; j++){
+      if(mid->sm[j] == &clean_sm){
+        continue;
+      }
+      const ULong* w = (const ULong*)((BitSecMap*)mid->sm[j])->bits;
+      for(UInt k = 0; k < SM_SIZE/64; k++){
+        n += popcount64(w[k]);
+      }
+    }
+  }
+  return n;
+}
+
+// make [addr, addr+len) untainted. clean secondaries are skipped and the
+// ones that end up all clean are freed, so clearing a large range costs
+// little more than the secondaries that were actually tainted
+static void clear_shadow_range(Addr addr, SizeT len){
+  // only cells the range covers whole are cleared
+  if(gran_shift != 0){
+    Addr c0 = CELL(addr + (1 << gran_shift) - 1), c1 = CELL(addr + len);
+    if(c1 <= c0){
+      return;
+    }
+    addr = c0;
+    len = c1 - c0;
+  }
+
+  if(bool_mode){
+    fill_bits(addr, len, 0);
+    return;
+  }
+
+  while(len > 0 && IS_SHADOWED(addr)){
+    SecMap* sm = get_sm(addr);
+    UInt off = addr & (SM_SIZE-1);
+    UInt n = (len < SM_SIZE - off)? len : SM_SIZE - off;
+
+    if(sm != &clean_sm){
+      for(UInt i = 0; i < n; i++){
+        if(sm->ids[off+i] != EMPTY_SET){
+          n_tainted_bytes--;
+          sm->n_tainted--;
+          unref_set(sm->ids[off+i]);
+          sm->ids[off+i] = EMPTY_SET;
+        }
+      }
+      if(sm->n_tainted == 0){
+        release_sm(addr);
+      }
+    }
+
+    addr += n;
+    len -= n;
+  }
+}
+
+// label the cells of [addr, addr+len), read from 'offset' on in 'source'.
+// a cell gets the label of the offset of its first byte in the range.
+// the bytes are overwritten by the read, so this replaces whatever taint
+// they had, also when labels run out part way: the rest is cleared. this
+// works a secondary map at a time, so a large read is a few tight loops
+// over the shadow rather than a call per byte
+static void taint_range(Addr addr, SizeT len, UInt source, ULong offset){
+  if(len == 0){
+    return;
+  }
+
+  if(bool_mode){
+    fill_bits(CELL(addr), CELL(addr + len - 1) - CELL(addr) + 1, 1);
+    return;
+  }
+
+  // consecutive offsets of a page have consecutive labels, so a label is
+  // only looked up at the start and at every page boundary
+  Label l = 0;
+  ULong next_page = offset;
+
+  if(gran_shift != 0){
+    // a cell the read only partly covers keeps the taint of its other
+    // bytes
+    Addr c0 = CELL(addr), c1 = CELL(addr + len - 1);
+    for(Addr c = c0; c <= c1; c++){
+      Addr x = ((c << gran_shift) < addr)? addr : c << gran_shift;
+      ULong off = offset + (x - addr);
+      if(off >= next_page || c == c0){
+        if(!get_label(source, off, &l)){
+          clear_shadow_range(x, addr + len - x);
+          break;
+        }
+        next_page = ((off >> DD_LABEL_PAGE_BITS) + 1) << DD_LABEL_PAGE_BITS;
+      }
+      else{
+        l = (l & ~((1 << page_label_bits) - 1))
+            + ((off & ((1 << DD_LABEL_PAGE_BITS) - 1)) >> gran_shift);
+      }
+      SetId id = singleton_set(l);
+      if((c << gran_shift) < addr || ((c+1) << gran_shift) > addr + len){
+        id = union_sets(get_cell(c), id);
+      }
+      put_cell(c, id);
+    }
+  }
+  else{
+    while(len > 0 && IS_SHADOWED(addr)){
+      SecMap* sm = get_sm_for_writing(addr);
+      UInt off = addr & (SM_SIZE-1);
+      UInt n = (len < SM_SIZE - off)? len : SM_SIZE - off;
+      UInt i;
+
+      for(i = 0; i < n; i++, offset++, l++){
+        if(offset == next_page){
+          if(!get_label(source, offset, &l)){
+            clear_shadow_range(addr + i, len - i);
+            break;
+          }
+          next_page = ((offset >> DD_LABEL_PAGE_BITS) + 1) << DD_LABEL_PAGE_BITS;
+        }
+        if(sm->ids[off+i] == EMPTY_SET){
+          n_tainted_bytes++;
+          sm->n_tainted++;
+        }
+        unref_set(sm->ids[off+i]);
+        sm->ids[off+i] = singleton_set(l);
+      }
+      if(i < n){
+        break;
+      }
+
+      addr += n;
+      len -= n;
+    }
+  }
+
+  taint_present = 1;
+  update_helpers_on();
+}
+
+// size of the guest state, and a buffer for reading its shadow
+static Int guest_state_sizeB = 0;
+static UChar* shadow_regs_buf = NULL;
+
+// signal handlers running, in all threads. the registers a signal
+// interrupted, shadows included, are saved in the signal frame on the
+// client stack until the handler returns, where we neither see nor
+// scan them. while any are there, sets are not swept and taint_present
+// is not cleared. a handler left with longjmp is never seen to return,
+// which only keeps both off for good
+static UInt n_in_handlers = 0;
+
+static void dd_pre_deliver_signal(ThreadId tid, Int sigNo, Bool alt_stack){
+  n_in_handlers++;
+}
+
+static void dd_post_deliver_signal(ThreadId tid, Int sigNo){
+  if(n_in_handlers > 0){
+    n_in_handlers--;
+  }
+}
+
+// clear taint_present if no shadow state holds a set any more. this runs
+// between blocks, when no shadow temps are live, so only memory and the
+// register shadows of every thread have to be checked, and not inside a
+// signal handler, see n_in_handlers
+static void update_taint_present(void){
+  if(!taint_present || mem_tainted() || guest_state_sizeB == 0 || n_in_handlers > 0){
+    return;
+  }
+
+  for(ThreadId tid = 1; tid < VG_N_THREADS; tid++){
+    if(!VG_(is_valid_tid)(tid)){
+      continue;
+    }
+    VG_(get_shadow_regs_area)(tid, shadow_regs_buf, 1, 0, guest_state_sizeB);
+    for(Int i = 0; i < guest_state_sizeB; i++){
+      if(shadow_regs_buf[i] != 0){
+        return;
+      }
+    }
+  }
+
+  taint_present = 0;
+  update_helpers_on();
+}
+
+// free the sets nothing refers to once enough of them piled up. temps
+// are dead between blocks, so apart from shadow memory only the register
+// shadows can still hold a set
+static void maybe_sweep_sets(void){
+  if(n_maybe_dead < SWEEP_MIN || guest_state_sizeB == 0 || n_in_handlers > 0){
+    return;
+  }
+
+  for(ThreadId tid = 1; tid < VG_N_THREADS; tid++){
+    if(!VG_(is_valid_tid)(tid)){
+      continue;
+    }
+    VG_(get_shadow_regs_area)(tid, shadow_regs_buf, 1, 0, guest_state_sizeB);
+    for(Int i = 0; i + sizeof(SetId) <= guest_state_sizeB; i += sizeof(SetId)){
+      pin_set(*(SetId*)(shadow_regs_buf + i));
+    }
+  }
+
+  sweep_sets();
+}
+
+// live sets by their number of labels, in power of two buckets
+static void print_set_sizes(void){
+  ULong buckets[32];
+  VG_(memset)(buckets, 0, sizeof(buckets));
+
+  for(SetId id = 0; id < n_sets; id++){
+    if(set_table[id] != NULL){
+      UInt b = 0;
+      while((set_table[id]->size >> (b + 1)) != 0){
+        b++;
+      }
+      buckets[b]++;
+    }
+  }
+
+  VG_(umsg)("dd: %u live sets of %u ids, by labels:\n", n_live_sets, n_sets);
+  for(UInt b = 0; b < 32; b++){
+    if(buckets[b] != 0){
+      VG_(umsg)("dd:   %10u - %-10u %llu\n", 1u << b, (UInt)((2ull << b) - 1), buckets[b]);
+    }
+  }
+}
+
+static void print_stats(void){
+  ULong helper_calls = stats[STAT_UNION_CALLS] + stats[STAT_LOAD_CALLS]
+                       + stats[STAT_STORE_CALLS] + stats[STAT_COPY_CALLS]
+                       + stats[STAT_CLEAR_CALLS];
+  ULong per_sb = (n_sbs_instrumented == 0)? 0 :
+                 (10*(n_helpers_elided + n_shadow_loads_elided)) / n_sbs_instrumented;
+
+  VG_(umsg)("dd: %llu superblocks instrumented, %llu helper calls and "
+            "%llu shadow loads elided (%llu.%llu per superblock)\n",
+            n_sbs_instrumented, n_helpers_elided, n_shadow_loads_elided,
+            per_sb / 10, per_sb % 10);
+  VG_(umsg)("dd: %llu helper calls, %llu set unions merging %llu labels\n",
+            helper_calls, n_unions, n_labels_merged);
+  if(n_sbs_skipped != 0){
+    VG_(umsg)("dd: %llu superblocks skipped by --dd-trace-fn, --dd-skip-fn "
+              "and --dd-skip-obj\n", n_sbs_skipped);
+  }
+  if(!clo_stats){
+    return;
+  }
+
+  VG_(umsg)("dd: helper calls: %llu dd_union, %llu dd_load_shadow, "
+            "%llu dd_store_tmp_to_addr, %llu dd_store_copy, %llu dd_clear_shadow\n",
+            stats[STAT_UNION_CALLS], stats[STAT_LOAD_CALLS], stats[STAT_STORE_CALLS],
+            stats[STAT_COPY_CALLS], stats[STAT_CLEAR_CALLS]);
+  VG_(umsg)("dd: client requests: %llu range copies, %llu range clears, "
+            "%llu queries\n", stats[STAT_CLIENT_COPIES], stats[STAT_CLIENT_CLEARS],
+            stats[STAT_CLIENT_QUERIES]);
+  VG_(umsg)("dd: inline: %llu register shadow reads, %llu writes, %llu memory "
+            "shadow loads, %llu stores, %llu unions\n",
+            stats[STAT_REG_GETS], stats[STAT_REG_PUTS], stats[STAT_MEM_LOADS],
+            stats[STAT_MEM_STORES], stats[STAT_UNIONS]);
+  VG_(umsg)("dd: set unions: %llu cached, %llu merged, %llu labels in, %llu out "
+            "(%llu deduplicated)\n",
+            n_union_hits, n_unions, n_labels_merged, n_labels_kept,
+            n_labels_merged - n_labels_kept);
+  VG_(umsg)("dd: secondary maps: %llu allocated, %llu in use (peak %llu)\n",
+            n_sm_allocs, n_private_sms, peak_private_sms);
+  if(!bool_mode){
+    print_set_sizes();
+  }
+}
+
+// the profile entry of the function containing 'addr', functions
+// without a name are counted per object
+static FnProfile* get_fn_profile(Addr addr){
+  const HChar* objname;
+  const HChar* fnname;
+  if(!VG_(get_objname)(addr, &objname)){
+    objname = "???";
+  }
+  if(!VG_(get_fnname)(addr, &fnname)){
+    fnname = "???";
+  }
+
+  UInt h = 2166136261u;
+  for(const HChar* c = fnname; *c; c++){
+    h = (h ^ (UChar)*c) * 16777619u;
+  }
+  for(const HChar* c = objname; *c; c++){
+    h = (h ^ (UChar)*c) * 16777619u;
+  }
+
+  FnProfile** b = &fn_buckets[h & (FN_BUCKETS-1)];
+  for(FnProfile* f = *b; f != NULL; f = f->next){
+    if(VG_(strcmp)(f->fnname, fnname) == 0 && VG_(strcmp)(f->objname, objname) == 0){
+      return f;
+    }
+  }
+
+  FnProfile* f = VG_(calloc)("dd.fn_profile", 1, sizeof(FnProfile));
+  f->fnname = VG_(strdup)("dd.fn_profile.fnname", fnname);
+  f->objname = VG_(strdup)("dd.fn_profile.objname", objname);
+  f->next = *b;
+  *b = f;
+  n_fns++;
+  return f;
+}
+
+static ULong fn_cost(const FnProfile* f){
+  return f->calls + f->unions;
+}
+
+// most expensive first
+static Int cmp_fn_cost(const void* a, const void* b){
+  ULong x = fn_cost(*(FnProfile* const*)a), y = fn_cost(*(FnProfile* const*)b);
+  return (x > y)? -1 : (x < y)? 1 : 0;
+}
+
+// the --dd-profile functions with the most helper calls and set unions
+static void print_profile(void){
+  FnProfile** fns = VG_(malloc)("dd.fn_profile.sorted", (n_fns + 1)*sizeof(FnProfile*));
+  UInt n = 0;
+  ULong total = fn_cost(&no_fn);
+
+  if(total != 0){
+    fns[n++] = &no_fn;
+  }
+  for(UInt i = 0; i < FN_BUCKETS; i++){
+    for(FnProfile* f = fn_buckets[i]; f != NULL; f = f->next){
+      fns[n++] = f;
+      total += fn_cost(f);
+    }
+  }
+  VG_(ssort)(fns, n, sizeof(FnProfile*), cmp_fn_cost);
+
+  VG_(umsg)("dd: top %u of %u functions by helper calls and set unions:\n",
+            (n < clo_profile)? n : clo_profile, n);
+  VG_(umsg)("dd: %6s %12s %12s %12s %14s  %s\n",
+            "%", "blocks", "calls", "unions", "labels", "function");
+  for(UInt i = 0; i < n && i < clo_profile; i++){
+    ULong pm = (total == 0)? 0 : (1000*fn_cost(fns[i])) / total;
+    VG_(umsg)("dd: %4llu.%llu %12llu %12llu %12llu %14llu  %s (%s)\n",
+              pm / 10, pm % 10, fns[i]->blocks, fns[i]->calls, fns[i]->unions,
+              fns[i]->labels, fns[i]->fnname, fns[i]->objname);
+  }
+  VG_(free)(fns);
+}
+
+static void free_profile(void){
+  for(UInt i = 0; i < FN_BUCKETS; i++){
+    FnProfile* f = fn_buckets[i];
+    while(f != NULL){
+      FnProfile* next = f->next;
+      VG_(free)(f->fnname);
+      VG_(free)(f->objname);
+      VG_(free)(f);
+      f = next;
+    }
+    fn_buckets[i] = NULL;
+  }
+}
+
+static void dd_start_client_code(ThreadId tid, ULong blocks_done){
+  update_taint_present();
+  maybe_sweep_sets();
+
+  if(clo_stats_interval > 0 && blocks_done >= next_stats_dump){
+    VG_(umsg)("dd: stats after %llu blocks\n", blocks_done);
+    print_stats();
+    next_stats_dump = blocks_done + clo_stats_interval;
+  }
+}
+
+// helpers called from the instrumented code. temps are shadowed by IR
+// temps holding set ids and registers by the shadow guest state, both are
+// read and written inline (see dd_instrument)
+
+// called on entry to main and exit
+static void dd_trace_start(void){
+  trace = True;
+}
+
+static void dd_trace_stop(void){
+  trace = False;
+}
+
+// the shadow of a load of 'size' bytes at 'addr' that spans more than
+// one cell: the union of their sets, or in bool mode 1 if any of them is
+// tainted. dd_instrument reads a single cell inline and only calls this
+// when the access may touch a tainted secondary or crosses into the next
+static VG_REGPARM(2) UWord dd_load_shadow(Addr addr, UWord size){
+  SetId id = EMPTY_SET;
+  count_call(STAT_LOAD_CALLS);
+  for(Addr c = CELL(addr); c <= CELL(addr + size - 1); c++){
+    if(bool_mode){
+      id |= get_bit(c);
+    }
+    else{
+      id = union_sets(id, get_cell(c));
+    }
+  }
+  return id;
+}
+
+// union of two distinct, non empty sets. every other case is handled
+// inline by dd_instrument
+static VG_REGPARM(2) UWord dd_union(UWord a, UWord b){
+  count_call(STAT_UNION_CALLS);
+  return union_sets(a, b);
+}
+
+
+// print a single label as its source and offset
+static void print_label(Label l){
+  VG_(printf)("[%u:%llu] ", label_source(l), label_offset(l));
+}
+
+// print a label set. ranges are printed as their first and last label,
+// and an approximate set is marked with a ~
+static void print_label_set(SetId id){
+  SingletonSet tmp;
+  LabelSet* s = get_any_set(id, &tmp);
+
+  if(!(s->flags & SET_RANGES)){
+    for_each_label(id, print_label);
+    return;
+  }
+
+  if(s->flags & SET_APPROX){
+    VG_(printf)("~");
+  }
+  for(UInt i = 0; i < s->n_chunks; i++){
+    LabelRange* r = &SET_RANGES_OF(s)[i];
+    if(r->lo == r->hi){
+      print_label(r->lo);
+    }
+    else{
+      VG_(printf)("[%u:%llu..%u:%llu] ", label_source(r->lo), label_offset(r->lo),
+                  label_source(r->hi), label_offset(r->hi));
+    }
+  }
+}
+
+// with --dd-log-file the provenance is written as a binary log instead,
+// see dd_logformat.h. records go into a large buffer which is written out
+// a megabyte at a time, and every set is written only once
+#define LOG_BUF_SIZE (1 << 20)
+
+static const HChar* clo_log_file = NULL;
+static Bool lazy_output = False;  // --dd-output=queries
+static Int log_fd = -1;
+static UChar* log_buf;
+static UInt log_used = 0;
+static Addr log_prev_addr = 0;
+static SetId log_prev_set = EMPTY_SET;
+static Label log_prev_label = 0;
+
+static void open_log(void){
+  HChar* name = VG_(expand_file_name)("--dd-log-file", clo_log_file);
+  SysRes sres = VG_(open)(name, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                          VKI_S_IRUSR|VKI_S_IWUSR);
+  if(sr_isError(sres)){
+    VG_(umsg)("error: can't open log file %s\n", name);
+    VG_(exit)(1);
+  }
+  log_fd = sr_Res(sres);
+  log_buf = VG_(malloc)("dd.log_buf", LOG_BUF_SIZE);
+  VG_(memcpy)(log_buf, DD_LOG_MAGIC, DD_LOG_MAGIC_LEN);
+  log_buf[DD_LOG_MAGIC_LEN] = gran_shift;
+  log_used = DD_LOG_MAGIC_LEN + 1;
+  VG_(free)(name);
+}
+
+static void flush_log(void){
+  UInt done = 0;
+  while(done < log_used){
+    Int n = VG_(write)(log_fd, log_buf + done, log_used - done);
+    if(n <= 0){
+      VG_(umsg)("error: writing the log file failed\n");
+      break;
+    }
+    done += n;
+  }
+  log_used = 0;
+}
+
+static void close_log(void){
+  flush_log();
+  VG_(close)(log_fd);
+  VG_(free)(log_buf);
+  log_fd = -1;
+}
+
+static void log_byte(UChar b){
+  if(log_used == LOG_BUF_SIZE){
+    flush_log();
+  }
+  log_buf[log_used++] = b;
+}
+
+static void log_uleb(ULong v){
+  do{
+    UChar b = v & 0x7F;
+    v >>= 7;
+    log_byte(v != 0? (b | 0x80) : b);
+  } while(v != 0);
+}
+
+// zigzag encoded v - prev
+static void log_delta(ULong v, ULong prev){
+  Long d = (Long)(v - prev);
+  log_uleb(((ULong)d << 1) ^ (ULong)(d >> 63));
+}
+
+static void log_label(Label label){
+  log_uleb(label - log_prev_label);
+  log_prev_label = label;
+}
+
+// define 'id' in the log unless that was already done. singleton ids
+// are never defined, the decoder knows their label from the id
+static void log_set(SetId id){
+  if(id == EMPTY_SET || IS_SINGLETON(id)){
+    return;
+  }
+  LabelSet* s = get_set(id);
+  if(s->flags & SET_LOGGED){
+    return;
+  }
+  s->flags |= SET_LOGGED;
+
+  if(s->flags & SET_RANGES){
+    log_byte(DD_REC_RANGES);
+    log_uleb(id);
+    log_uleb((s->flags & SET_APPROX) != 0);
+    log_uleb(s->n_chunks);
+    log_prev_label = 0;
+    for(UInt i = 0; i < s->n_chunks; i++){
+      log_label(SET_RANGES_OF(s)[i].lo);
+      log_uleb(SET_RANGES_OF(s)[i].hi - SET_RANGES_OF(s)[i].lo);
+      log_prev_label = SET_RANGES_OF(s)[i].hi;
+    }
+    return;
+  }
+
+  log_byte(DD_REC_SET);
+  log_uleb(id);
+  log_uleb(s->size);
+  log_prev_label = 0;
+  for_each_label(id, log_label);
+}
+
+// log the label pages handed out since the last call, in order, so the
+// decoder can number them
+static UInt n_logged_pages = 0;
+
+static void log_pages(void){
+  for(; n_logged_pages < n_label_pages; n_logged_pages++){
+    log_byte(DD_REC_PAGE);
+    log_uleb(label_pages[n_logged_pages].source);
+    log_uleb(label_pages[n_logged_pages].page);
+  }
+}
+
+// report a read of 'len' bytes from 'offset' on in 'source' into 'addr',
+// one record for the whole buffer. a source is named before its first
+// read
+static void output_source(UInt source, ULong offset, Addr addr, SizeT len){
+  Source* src = &sources[source];
+
+  if(log_fd >= 0){
+    if(!src->announced){
+      UInt n = VG_(strlen)(src->name);
+      log_byte(DD_REC_NAME);
+      log_uleb(source);
+      log_uleb(n);
+      for(UInt i = 0; i < n; i++){
+        log_byte(src->name[i]);
+      }
+    }
+    log_pages();
+    log_byte(DD_REC_SOURCE);
+    log_delta(addr, log_prev_addr);
+    log_uleb(source);
+    log_uleb(offset);
+    log_uleb(len);
+    log_prev_addr = addr;
+  }
+  else{
+    if(!src->announced){
+      VG_(printf)("[DD]: source %u is %s\n", source, src->name);
+    }
+    VG_(printf)("0x%08lx [DD]: source %u, offset %llu, %lu bytes\n",
+                addr, source, offset, len);
+  }
+  src->announced = True;
+}
+
+// report a store of a value tainted by 'set' to 'addr'
+static void write_store(Addr addr, SetId set){
+  if(log_fd >= 0){
+    log_set(set);
+    log_byte(DD_REC_STORE);
+    log_delta(addr, log_prev_addr);
+    log_delta(set, log_prev_set);
+    log_prev_addr = addr;
+    log_prev_set = set;
+    return;
+  }
+  VG_(printf)("0x%08lx [DD]: ", addr);
+  print_label_set(set);
+  VG_(printf)("\n");
+}
+
+// report a run of 'n_cells' tainted cells from 'addr' on, found by a
+// query in bool mode
+static void write_tainted(Addr addr, UWord n_cells){
+  if(log_fd >= 0){
+    log_byte(DD_REC_TAINTED);
+    log_delta(addr, log_prev_addr);
+    log_uleb(n_cells);
+    log_prev_addr = addr;
+    return;
+  }
+  VG_(printf)("0x%08lx [DD]: tainted, %lu %s\n", addr, n_cells,
+              (gran_shift == 0)? "bytes" : "cells");
+}
+
+// a store of a tainted value. with --dd-output=queries nothing is
+// printed until the client asks, see query_range, and nothing is
+// printed while not tracing, though the shadow is still updated
+static void output_store(Addr addr, SetId set){
+  if(!lazy_output && trace){
+    write_store(addr, set);
+  }
+}
+
+
+
+// store instruction. in bool mode this only runs when the bits can not
+// be set inline, see emit_store_shadow
+static VG_REGPARM(3) void dd_store_tmp_to_addr(Addr addr, UWord set_data, UWord size){
+  count_call(STAT_STORE_CALLS);
+
+  if(bool_mode){
+    fill_bits(CELL(addr), CELL(addr + size - 1) - CELL(addr) + 1, 1);
+    return;
+  }
+
+  // here we print the provanence
+  if(set_data != EMPTY_SET){
+    set_shadow_mem(addr, size, set_data);
+    output_store(addr, set_data);
+  }
+
+}
+
+// the largest value a block can load and store, a V256
+#define MAX_ACCESS 32
+
+// a value loaded from 'src' and stored unchanged to 'dst'. rather than
+// the union of the whole value every cell gets the sets of the source
+// bytes it was copied from, so the lanes of vectorized copy loops stay
+// apart as they do with memcpy. every run of cells with the same set is
+// reported as one store
+static VG_REGPARM(3) void dd_store_copy(Addr dst, Addr src, UWord size){
+  SetId ids[MAX_ACCESS + 1];
+  Addr c0 = CELL(dst), c1 = CELL(dst + size - 1);
+  count_call(STAT_COPY_CALLS);
+
+  // the source may overlap the destination, read it all first
+  for(Addr c = c0; c <= c1; c++){
+    Addr lo = ((c << gran_shift) < dst)? dst : c << gran_shift;
+    Addr hi = (((c+1) << gran_shift) > dst + size)? dst + size : (c+1) << gran_shift;
+    SetId id = EMPTY_SET;
+    for(Addr sc = CELL(src + (lo - dst)); sc <= CELL(src + (hi - 1 - dst)); sc++){
+      id = union_sets(id, get_cell(sc));
+    }
+    ids[c - c0] = id;
+  }
+
+  for(Addr c = c0; c <= c1; c++){
+    SetId id = ids[c - c0];
+    if(id == EMPTY_SET){
+      continue;
+    }
+    put_cell(c, union_sets(get_cell(c), id));
+    if(c == c0 || ids[c - c0 - 1] != id){
+      output_store((c == c0)? dst : c << gran_shift, id);
+    }
+  }
+}
+
+
+// function replacements, see dd_replace_strmem.c. these move the shadow
+// of a whole buffer at once
+
+// copy the shadow of up to one secondary map worth of bytes, 'src' and
+// 'dst' each stay within one secondary. with 'report' the tainted bytes
+// are reported as stores
+static void copy_shadow_piece(Addr dst, Addr src, UInt n, Bool report){
+  if(!IS_SHADOWED(dst)){
+    return;
+  }
+  SecMap* src_sm = IS_SHADOWED(src)? get_sm(src) : &clean_sm;
+  SecMap* dst_sm = get_sm(dst);
+  const SetId* s = &src_sm->ids[src & (SM_SIZE-1)];
+  UInt i;
+
+  // copying clean bytes over clean bytes changes nothing
+  if(dst_sm == &clean_sm){
+    for(i = 0; i < n && s[i] == EMPTY_SET; i++);
+    if(i == n){
+      return;
+    }
+    dst_sm = get_sm_for_writing(dst);
+  }
+
+  SetId* d = &dst_sm->ids[dst & (SM_SIZE-1)];
+  for(i = 0; i < n; i++){
+    ref_set(s[i]);
+  }
+  for(i = 0; i < n; i++){
+    if(d[i] != EMPTY_SET){
+      n_tainted_bytes--;
+      dst_sm->n_tainted--;
+      unref_set(d[i]);
+    }
+  }
+  VG_(memmove)(d, s, n*sizeof(SetId));
+
+  // report every run of bytes with the same set as one store
+  for(i = 0; i < n; ){
+    SetId id = d[i];
+    UInt j = i + 1;
+    while(j < n && d[j] == id){
+      j++;
+    }
+    if(id != EMPTY_SET){
+      n_tainted_bytes += j - i;
+      dst_sm->n_tainted += j - i;
+      if(report){
+        output_store(dst + i, id);
+      }
+    }
+    i = j;
+  }
+
+  if(dst_sm->n_tainted == 0){
+    release_sm(dst);
+  }
+}
+
+// at a coarse granularity the cells of the source and the destination
+// need not line up. every destination cell gets the union of the source
+// cells its bytes come from, and keeps its own set as well unless the
+// copy covers it whole. the ranges may overlap, so all the new sets are
+// found before any is written
+static void copy_shadow_coarse(Addr dst, Addr src, SizeT len, Bool report){
+  if(len == 0){
+    return;
+  }
+
+  Addr c0 = CELL(dst), c1 = CELL(dst + len - 1);
+  SetId* ids = VG_(malloc)("dd.copy_ids", (c1 - c0 + 1)*sizeof(SetId));
+
+  for(Addr c = c0; c <= c1; c++){
+    Addr lo = ((c << gran_shift) < dst)? dst : c << gran_shift;
+    Addr hi = (((c+1) << gran_shift) > dst + len)? dst + len : (c+1) << gran_shift;
+    SetId id = EMPTY_SET;
+    for(Addr sc = CELL(src + (lo - dst)); sc <= CELL(src + (hi - 1 - dst)); sc++){
+      id = union_sets(id, get_cell(sc));
+    }
+    ids[c - c0] = id;
+  }
+
+  for(Addr c = c0; c <= c1; c++){
+    SetId id = ids[c - c0];
+    Addr lo = ((c << gran_shift) < dst)? dst : c << gran_shift;
+    Bool whole = lo == (c << gran_shift) && ((c+1) << gran_shift) <= dst + len;
+    put_cell(c, whole? id : union_sets(get_cell(c), id));
+
+    // report every run of cells with the same set as one store
+    if(report && id != EMPTY_SET && (c == c0 || ids[c - c0 - 1] != id)){
+      output_store(lo, id);
+    }
+  }
+
+  VG_(free)(ids);
+}
 
-// data structure to store address information
-typedef struct AddrNode_{
-  Int addr;
-  struct AddrNode_ * next;
-} AddrNode;
+// the same for bool mode, where there are no stores to report
+static void copy_bits(Addr dst, Addr src, SizeT len){
+  if(len == 0){
+    return;
+  }
+
+  Addr c0 = CELL(dst), c1 = CELL(dst + len - 1);
+  UChar* v = VG_(malloc)("dd.copy_bits", c1 - c0 + 1);
+
+  for(Addr c = c0; c <= c1; c++){
+    Addr lo = ((c << gran_shift) < dst)? dst : c << gran_shift;
+    Addr hi = (((c+1) << gran_shift) > dst + len)? dst + len : (c+1) << gran_shift;
+    UInt b = 0;
+    for(Addr sc = CELL(src + (lo - dst)); sc <= CELL(src + (hi - 1 - dst)); sc++){
+      b |= get_bit(sc);
+    }
+    if(lo != (c << gran_shift) || ((c+1) << gran_shift) > dst + len){
+      b |= get_bit(c);
+    }
+    v[c - c0] = b;
+  }
+
+  for(Addr c = c0; c <= c1; c++){
+    put_bit(c, v[c - c0]);
+  }
+  VG_(free)(v);
+}
 
-typedef struct AddrList_ {
-  AddrNode* head;
-} AddrList;
+// give [dst, dst+len) the taint of [src, src+len), replacing what the
+// destination had. the ranges may overlap, as for memmove
+static void copy_shadow_range(Addr dst, Addr src, SizeT len, Bool report){
+  if(bool_mode){
+    copy_bits(dst, src, len);
+    return;
+  }
 
-// add a new address to the list
-static void update_addr_list(AddrList* list, Int addr){
-  AddrNode* new_node = VG_(malloc)("addr node", sizeof(AddrNode));
-  new_node->addr = addr;
-  new_node->next = NULL;
+  if(gran_shift != 0){
+    copy_shadow_coarse(dst, src, len, report);
+    return;
+  }
 
-  //VG_(printf)("created new addr node : addr %x value %x\n", addr, *((HChar*)addr));
+  Bool backwards = dst > src && dst - src < len;
+
+  while(len > 0){
+    UInt n;
+    if(backwards){
+      // the last piece, ending at the end of a secondary on either side
+      n = ((src + len - 1) & (SM_SIZE-1)) + 1;
+      UInt dn = ((dst + len - 1) & (SM_SIZE-1)) + 1;
+      if(dn < n) n = dn;
+      if(len < n) n = len;
+      copy_shadow_piece(dst + len - n, src + len - n, n, report);
+    }
+    else{
+      n = SM_SIZE - (src & (SM_SIZE-1));
+      UInt dn = SM_SIZE - (dst & (SM_SIZE-1));
+      if(dn < n) n = dn;
+      if(len < n) n = len;
+      copy_shadow_piece(dst, src, n, report);
+      dst += n;
+      src += n;
+    }
+    len -= n;
+  }
+}
 
-  if(list->head == NULL){
-    //VG_(printf)("setting head for addr %lx\n", addr);
-    list->head = new_node;
+// a write by code skipped with --dd-skip-model=clear, see instrument_skipped
+static VG_REGPARM(2) void dd_clear_shadow(Addr addr, UWord size){
+  count_call(STAT_CLEAR_CALLS);
+  clear_shadow_range(addr, size);
+}
 
+// one run of cells with the same set found by a query
+static void report_run(Addr addr, SetId id, UWord n_cells){
+  if(bool_mode){
+    write_tainted(addr, n_cells);
   }
   else{
-    //VG_(printf)("head is already set\n");
-    Bool found = False;
-
-    AddrNode* curr = list->head;
-    AddrNode* prev = NULL;
-    while(curr != NULL){
-      if(curr->addr == addr){
-        //VG_(printf)("addr found\n");
-        found = True;
-        VG_(free)(new_node);
+    write_store(addr, id);
+  }
+}
+
+// VALGRIND_DD_QUERY: report the taint of [addr, addr+len) as stores,
+// one per run of cells with the same set, or in bool mode one line per
+// run of tainted cells. clean secondaries are skipped whole. returns the
+// number of tainted cells
+static UWord query_range(Addr addr, SizeT len){
+  UWord n = 0;
+  if(len == 0){
+    return 0;
+  }
+
+  Addr c1 = CELL(addr + len - 1);
+  Addr run = 0;
+  UWord run_n = 0;
+  SetId run_id = EMPTY_SET;
+  for(Addr c = CELL(addr); c <= c1; c++){
+    SetId id = EMPTY_SET;
+    if(!IS_SHADOWED(c) || get_sm(c) == &clean_sm){
+      Addr next = (c | (SM_SIZE-1)) + 1;
+      c = (next - 1 < c1)? next - 1 : c1;
+    }
+    else{
+      id = bool_mode? get_bit(c) : get_cell(c);
+    }
+
+    if(id != run_id){
+      if(run_id != EMPTY_SET){
+        report_run(run, run_id, run_n);
+      }
+      run = ((c << gran_shift) < addr)? addr : c << gran_shift;
+      run_id = id;
+      run_n = 0;
+    }
+    if(id != EMPTY_SET){
+      run_n++;
+      n++;
+    }
+  }
+
+  if(run_id != EMPTY_SET){
+    report_run(run, run_id, run_n);
+  }
+  return n;
+}
+
+static Bool dd_handle_client_request(ThreadId tid, UWord* arg, UWord* ret){
+  if(!VG_IS_TOOL_USERREQ('D','D',arg[0])){
+    return False;
+  }
+
+  *ret = 0;
+  // memory requests keep the shadow right whether or not we are tracing,
+  // like dd_clear_mem, and nothing needs to move while no byte is tainted
+  switch(arg[0]){
+    case VG_USERREQ__DD_START:
+      dd_trace_start();
+      break;
+    case VG_USERREQ__DD_STOP:
+      dd_trace_stop();
+      break;
+    case VG_USERREQ__DD_QUERY:
+      count_call(STAT_CLIENT_QUERIES);
+      *ret = query_range(arg[1], arg[2]);
+      break;
+    case VG_USERREQ__DD_CLEAR:
+      count_call(STAT_CLIENT_CLEARS);
+      if(mem_tainted()){
+        clear_shadow_range(arg[1], arg[2]);
+      }
+      break;
+    case _VG_USERREQ__DD_COPY_RANGE:
+      count_call(STAT_CLIENT_COPIES);
+      if(mem_tainted()){
+        copy_shadow_range(arg[1], arg[2], arg[3], True);
+      }
+      break;
+    case _VG_USERREQ__DD_CLEAR_RANGE:
+      count_call(STAT_CLIENT_CLEARS);
+      if(mem_tainted()){
+        clear_shadow_range(arg[1], arg[2]);
+      }
+      break;
+    default:
+      return False;
+  }
+
+  return True;
+}
+
+
+// memory that is freed, unmapped or popped off the stack is cleared, so
+// stale taint does not flow into whatever reuses it and the shadow of it
+// can be freed
+static void dd_clear_mem(Addr a, SizeT len){
+  if(mem_tainted()){
+    clear_shadow_range(a, len);
+  }
+}
+
+// heap blocks of the client, so free knows how much shadow to clear
+typedef struct _HeapBlock {
+  struct _HeapBlock* next;
+  UWord data;               // address of the block, the hash key
+  SizeT size;
+} HeapBlock;
+
+static VgHashTable* heap_blocks = NULL;
+
+static void* new_block(SizeT size, SizeT align, Bool is_zeroed){
+  void* p = VG_(cli_malloc)(align, size);
+  if(p == NULL){
+    return NULL;
+  }
+  if(is_zeroed){
+    VG_(memset)(p, 0, size);
+    dd_clear_mem((Addr)p, size);
+  }
+
+  HeapBlock* b = VG_(malloc)("dd.heap_block", sizeof(HeapBlock));
+  b->data = (UWord)p;
+  b->size = size;
+  VG_(HT_add_node)(heap_blocks, b);
+  return p;
+}
+
+static void* dd_malloc(ThreadId tid, SizeT n){
+  return new_block(n, VG_(clo_alignment), False);
+}
+
+static void* dd_memalign(ThreadId tid, SizeT align, SizeT n){
+  return new_block(n, align, False);
+}
+
+static void* dd_calloc(ThreadId tid, SizeT nmemb, SizeT size1){
+  // the size must not overflow
+  if(nmemb != 0 && size1 > ((SizeT)-1) / nmemb){
+    return NULL;
+  }
+  return new_block(nmemb*size1, VG_(clo_alignment), True);
+}
+
+static void dd_free(ThreadId tid, void* p){
+  HeapBlock* b = VG_(HT_remove)(heap_blocks, (UWord)p);
+  if(b == NULL){
+    return;
+  }
+  dd_clear_mem(b->data, b->size);
+  VG_(cli_free)(p);
+  VG_(free)(b);
+}
+
+// the data moves to a new block, and its taint with it
+static void* dd_realloc(ThreadId tid, void* p_old, SizeT new_size){
+  if(p_old == NULL){
+    return dd_malloc(tid, new_size);
+  }
+  HeapBlock* b = VG_(HT_remove)(heap_blocks, (UWord)p_old);
+  if(b == NULL){
+    return NULL;
+  }
+
+  void* p_new = VG_(cli_malloc)(VG_(clo_alignment), new_size);
+  if(p_new == NULL){
+    VG_(HT_add_node)(heap_blocks, b);
+    return NULL;
+  }
+  SizeT n = (new_size < b->size)? new_size : b->size;
+  VG_(memcpy)(p_new, p_old, n);
+  if(mem_tainted()){
+    copy_shadow_range((Addr)p_new, (Addr)p_old, n, False);
+    clear_shadow_range((Addr)p_old, b->size);
+  }
+  VG_(cli_free)(p_old);
+
+  b->data = (UWord)p_new;
+  b->size = new_size;
+  VG_(HT_add_node)(heap_blocks, b);
+  return p_new;
+}
+
+static SizeT dd_malloc_usable_size(ThreadId tid, void* p){
+  HeapBlock* b = VG_(HT_lookup)(heap_blocks, (UWord)p);
+  return (b == NULL)? 0 : b->size;
+}
+
+
+//syscall handlers
+static void dd_pre_call(ThreadId tid, UInt syscallno,
+                                    UWord* args, UInt nArgs){
+
+}
+
+// 'len' bytes read from 'fd' at 'offset' into 'addr'. while tracing
+// the bytes of selected sources are labelled. all other reads make the
+// bytes untainted
+static void input(Int fd, ULong offset, Addr addr, SizeT len){
+  FdState* f = get_fd(fd);
+  if(len == 0){
+    return;
+  }
+
+  if(trace && f != NULL){
+    UInt source = fd_source(f, fd);
+    if(sources[source].selected){
+      taint_range(addr, len, source, offset);
+      output_source(source, offset, addr, len);
+      return;
+    }
+  }
+  if(mem_tainted()){
+    clear_shadow_range(addr, len);
+  }
+}
+
+// a read at the offset of the descriptor, which it moves on
+static void input_at_pos(Int fd, Addr addr, SizeT len){
+  FdState* f = get_fd(fd);
+  if(f != NULL){
+    ULong offset = f->pos;
+    f->pos += len;
+    input(fd, offset, addr, len);
+  }
+}
+
+// can the client read 'len' bytes at 'a'? syscall arguments pointing
+// at memory are checked before we follow them, since the kernel does not
+// read all of them and a bad one must not crash the tool
+static Bool client_readable(Addr a, SizeT len){
+  return VG_(am_is_valid_for_client)(a, len, VKI_PROT_READ);
+}
+
+// a read of 'len' bytes into the 'n_iov' buffers of 'iov', in order
+static void input_iov(Int fd, ULong offset, const struct vki_iovec* iov, UWord n_iov,
+                      SizeT len){
+  if(!client_readable((Addr)iov, n_iov*sizeof(struct vki_iovec))){
+    return;
+  }
+  for(UWord i = 0; i < n_iov && len > 0; i++){
+    SizeT n = (iov[i].iov_len < len)? iov[i].iov_len : len;
+    input(fd, offset, (Addr)iov[i].iov_base, n);
+    offset += n;
+    len -= n;
+  }
+}
+
+static void input_iov_at_pos(Int fd, const struct vki_iovec* iov, UWord n_iov, SizeT len){
+  FdState* f = get_fd(fd);
+  if(f != NULL){
+    ULong offset = f->pos;
+    f->pos += len;
+    input_iov(fd, offset, iov, n_iov, len);
+  }
+}
+
+// a mapping of 'len' bytes of the file open on 'fd' from 'offset'.
+// only the part inside the file is input, and ELF objects are not: the
+// loader maps the data of every library it loads, after main with
+// dlopen, NSS and iconv modules
+static void input_mapped(Int fd, ULong offset, Addr addr, SizeT len){
+  struct vg_stat st;
+  HChar magic[4];
+  if(VG_(fstat)(fd, &st) != 0 || offset >= (ULong)st.size){
+    return;
+  }
+  if(VG_(pread)(fd, magic, 4, 0) == 4 && VG_(memcmp)(magic, "\177ELF", 4) == 0){
+    return;
+  }
+  if(len > (ULong)st.size - offset){
+    len = (ULong)st.size - offset;
+  }
+  input(fd, offset, addr, len);
+}
+
+// the 64 bit argument of a syscall that starts at args[i]. 32 bit
+// platforms pass it in two words in the order of their endianness
+static ULong arg64(UWord* args, Int i){
+#if VG_WORDSIZE == 8
+  return args[i];
+#elif defined(VG_BIGENDIAN)
+  return ((ULong)args[i] << 32) | args[i+1];
+#else
+  return ((ULong)args[i+1] << 32) | args[i];
+#endif
+}
+
+// where pread64 has its offset: 32 bit platforms other than x86 start
+// 64 bit arguments at an even register
+#if VG_WORDSIZE == 8 || defined(VGA_x86)
+#define PREAD_OFFSET_ARG 3
+#else
+#define PREAD_OFFSET_ARG 4
+#endif
+
+// file descriptors are followed whether or not we are tracing, input is
+// only labelled while tracing. syscalls a platform does not have, such
+// as open on arm64 or recvfrom on x86 (which uses socketcall), are left
+// out by their numbers not being defined
+static void dd_post_call(ThreadId tid, UInt syscallno,
+                                    UWord* args, UInt nArgs, SysRes res){
+    if(sr_isError(res)){
+        return;
+    }
+
+    switch(syscallno){
+#if defined(__NR_open)
+        case __NR_open:
+#endif
+#if defined(__NR_openat)
+        case __NR_openat:
+#endif
+#if defined(__NR_socket)
+        case __NR_socket:
+#endif
+#if defined(__NR_accept)
+        case __NR_accept:
+#endif
+#if defined(__NR_accept4)
+        case __NR_accept4:
+#endif
+            reset_fd(sr_Res(res));
+            break;
+        case __NR_close:
+            reset_fd(args[0]);
+            break;
+        case __NR_dup:
+            copy_fd(args[0], sr_Res(res));
+            break;
+#if defined(__NR_dup2)
+        case __NR_dup2:
+#endif
+#if defined(__NR_dup3)
+        case __NR_dup3:
+#endif
+            copy_fd(args[0], args[1]);
+            break;
+#if defined(__NR_fcntl)
+        case __NR_fcntl:
+#endif
+#if defined(__NR_fcntl64)
+        case __NR_fcntl64:
+#endif
+            if(args[1] == VKI_F_DUPFD || args[1] == VKI_F_DUPFD_CLOEXEC){
+                copy_fd(args[0], sr_Res(res));
+            }
+            break;
+#if defined(__NR_lseek)
+        case __NR_lseek:
+            if(get_fd(args[0]) != NULL){
+                get_fd(args[0])->pos = sr_Res(res);
+            }
+            break;
+#endif
+#if defined(__NR__llseek)
+        case __NR__llseek:
+            if(get_fd(args[0]) != NULL && client_readable(args[3], sizeof(ULong))){
+                get_fd(args[0])->pos = *(ULong*)args[3];
+            }
+            break;
+#endif
+
+        // input. only the bytes actually read are labelled
+        case __NR_read:
+#if defined(__NR_recvfrom)
+        case __NR_recvfrom:
+#endif
+#if defined(__NR_recv)
+        case __NR_recv:
+#endif
+            input_at_pos(args[0], args[1], sr_Res(res));
+            break;
+        case __NR_pread64:
+            input(args[0], arg64(args, PREAD_OFFSET_ARG), args[1], sr_Res(res));
+            break;
+        case __NR_readv:
+            input_iov_at_pos(args[0], (struct vki_iovec*)args[1], args[2], sr_Res(res));
+            break;
+#if defined(__NR_preadv)
+        case __NR_preadv:
+            // the offset is passed as low and high words on every platform
+            input_iov(args[0], (VG_WORDSIZE == 8)? args[3] : args[3] | ((ULong)args[4] << 32),
+                      (struct vki_iovec*)args[1], args[2], sr_Res(res));
+            break;
+#endif
+#if defined(__NR_recvmsg)
+        case __NR_recvmsg:
+            {
+                struct vki_msghdr* msg = (struct vki_msghdr*)args[1];
+                if(client_readable(args[1], sizeof(struct vki_msghdr))){
+                    input_iov_at_pos(args[0], msg->msg_iov, msg->msg_iovlen, sr_Res(res));
+                }
+            }
+            break;
+#endif
+#if defined(__NR_socketcall)
+        case __NR_socketcall:
+            {
+                // the arguments of the call are in memory, the ones we
+                // look at are the first two
+                UWord* a = (UWord*)args[1];
+                if(!client_readable(args[1], 2*sizeof(UWord))){
+                    break;
+                }
+                switch(args[0]){
+                    case VKI_SYS_SOCKET:
+                    case VKI_SYS_ACCEPT:
+                    case VKI_SYS_ACCEPT4:
+                        reset_fd(sr_Res(res));
+                        break;
+                    case VKI_SYS_RECV:
+                    case VKI_SYS_RECVFROM:
+                        input_at_pos(a[0], a[1], sr_Res(res));
+                        break;
+                    case VKI_SYS_RECVMSG:
+                        {
+                            struct vki_msghdr* msg = (struct vki_msghdr*)a[1];
+                            if(client_readable(a[1], sizeof(struct vki_msghdr))){
+                                input_iov_at_pos(a[0], msg->msg_iov, msg->msg_iovlen,
+                                                 sr_Res(res));
+                            }
+                        }
+                        break;
+                }
+            }
+            break;
+#endif
+
+        // with --dd-mmap=yes a file mapped while tracing is input too,
+        // except code. the mmap of x86 and s390x takes its arguments in
+        // memory, leave it
+#if defined(__NR_mmap) && !defined(VGA_x86) && !defined(VGA_s390x)
+        case __NR_mmap:
+#endif
+#if defined(__NR_mmap2)
+        case __NR_mmap2:
+#endif
+            if(clo_mmap && !(args[3] & VKI_MAP_ANONYMOUS) && !(args[2] & VKI_PROT_EXEC)){
+#if defined(__NR_mmap2)
+                ULong offset = (syscallno == __NR_mmap2)? (ULong)args[5] * 4096 : args[5];
+#else
+                ULong offset = args[5];
+#endif
+                input_mapped(args[4], offset, sr_Res(res), args[1]);
+            }
+            break;
+    }
+}
+
+// --dd-trace-fn, --dd-skip-fn and --dd-skip-obj: comma separated globs
+// of the functions to instrument, and of the functions and objects not
+// to. blocks they rule out get the cheap model of instrument_skipped
+static const HChar* clo_trace_fn = NULL;
+static const HChar* clo_skip_fn = NULL;
+static const HChar* clo_skip_obj = NULL;
+static GlobList trace_fns, skip_fns, skip_objs;
+
+// --dd-skip-model, what skipped code does to the shadow of what it writes
+static Bool skip_clear = False;
+
+// is the block ruled out by the filters? code without symbols is only
+// matched by --dd-skip-obj and by "???"
+static Bool is_skipped(const VexGuestExtents* vge){
+  const HChar* name;
+  if(skip_objs.n != 0 && VG_(get_objname)(vge->base[0], &name)
+     && match_globs(&skip_objs, name)){
+    return True;
+  }
+  if(trace_fns.n == 0 && skip_fns.n == 0){
+    return False;
+  }
+  if(!VG_(get_fnname)(vge->base[0], &name)){
+    name = "???";
+  }
+  return (trace_fns.n != 0 && !match_globs(&trace_fns, name))
+         || (skip_fns.n != 0 && match_globs(&skip_fns, name));
+}
+
+// command line options
+static Bool dd_process_cmd_line_option(const HChar* arg)
+{
+   if VG_STR_CLO(arg, "--dd-log-file", clo_log_file) {}
+   else if VG_XACT_CLO(arg, "--dd-mode=prov", bool_mode, False) {}
+   else if VG_XACT_CLO(arg, "--dd-mode=bool", bool_mode, True) {}
+   else if VG_INT_CLO(arg, "--dd-max-labels", clo_max_labels) {
+      if (clo_max_labels < 0)
+         VG_(fmsg_bad_option)(arg, "the number of labels must not be negative\n");
+   }
+   else if VG_INT_CLO(arg, "--dd-granularity", clo_granularity) {
+      if (clo_granularity != 1 && clo_granularity != 4
+          && clo_granularity != 8 && clo_granularity != 64)
+         VG_(fmsg_bad_option)(arg, "granularity must be 1, 4, 8 or 64\n");
+   }
+   else if VG_XACT_CLO(arg, "--dd-trace=main", trace_by_client, False) {}
+   else if VG_XACT_CLO(arg, "--dd-trace=client", trace_by_client, True) {}
+   else if VG_XACT_CLO(arg, "--dd-output=stores", lazy_output, False) {}
+   else if VG_XACT_CLO(arg, "--dd-output=queries", lazy_output, True) {}
+   else if VG_STR_CLO(arg, "--dd-sources", clo_sources) {}
+   else if VG_BOOL_CLO(arg, "--dd-mmap", clo_mmap) {}
+   else if VG_STR_CLO(arg, "--dd-trace-fn", clo_trace_fn) {}
+   else if VG_STR_CLO(arg, "--dd-skip-fn", clo_skip_fn) {}
+   else if VG_STR_CLO(arg, "--dd-skip-obj", clo_skip_obj) {}
+   else if VG_XACT_CLO(arg, "--dd-skip-model=taint", skip_clear, False) {}
+   else if VG_XACT_CLO(arg, "--dd-skip-model=clear", skip_clear, True) {}
+   else if VG_BOOL_CLO(arg, "--dd-stats", clo_stats) {}
+   else if VG_INT_CLO(arg, "--dd-profile", clo_profile) {
+      if (clo_profile < 0)
+         VG_(fmsg_bad_option)(arg, "the number of functions must not be negative\n");
+   }
+   else if VG_INT_CLO(arg, "--dd-stats-interval", clo_stats_interval) {
+      if (clo_stats_interval < 0)
+         VG_(fmsg_bad_option)(arg, "the interval must not be negative\n");
+   }
+   else
+      return VG_(replacement_malloc_process_cmd_line_option)(arg);
+
+   return True;
+}
+
+static void dd_print_usage(void)
+{
+   VG_(printf)(
+"    --dd-mode=prov|bool       track where tainted data came from, or only\n"
+"                              whether it is tainted, which is much cheaper\n"
+"                              and prints no stores [prov]\n"
+"    --dd-log-file=<file>      write provenance to <file> as a binary log,\n"
+"                              decode it with dd_decode [text on stdout]\n"
+"    --dd-granularity=1|4|8|64 bytes covered by one shadow entry, coarser\n"
+"                              is faster and smaller but less precise [1]\n"
+"    --dd-max-labels=<N>       keep sets of more than N labels as at most N\n"
+"                              label ranges, approximate if need be,\n"
+"                              0 for exact sets [0]\n"
+"    --dd-sources=<globs>      only label input from sources, the targets of\n"
+"                              /proc/self/fd links, matching one of the\n"
+"                              comma separated globs, e.g. '/data/*' [all]\n"
+"    --dd-mmap=no|yes          treat files mapped while tracing as input,\n"
+"                              except code and ELF objects [no]\n"
+"    --dd-trace=main|client    trace from main to exit, or only between the\n"
+"                              VALGRIND_DD_START and VALGRIND_DD_STOP client\n"
+"                              requests of ddtector.h [main]\n"
+"    --dd-output=stores|queries  report every tainted store, or only what\n"
+"                              VALGRIND_DD_QUERY asks for [stores]\n"
+"    --dd-trace-fn=<globs>     only instrument functions matching one of\n"
+"                              the comma separated globs [all]\n"
+"    --dd-skip-fn=<globs>      do not instrument functions matching them\n"
+"    --dd-skip-obj=<globs>     nor code in objects whose path matches them,\n"
+"                              e.g. '*/libc.so*,*/ld-linux*'\n"
+"    --dd-skip-model=taint|clear  what code not instrumented writes: the\n"
+"                              taint of the registers it read, or nothing\n"
+"                              [taint]\n"
+"    --dd-stats=no|yes         count helper calls, inline shadow accesses,\n"
+"                              set unions and shadow memory, and print\n"
+"                              them at exit [no]\n"
+"    --dd-stats-interval=<N>   also print them about every N blocks,\n"
+"                              implies --dd-stats=yes [0]\n"
+"    --dd-profile=<N>          charge helper calls and set unions to the\n"
+"                              guest functions making them, and print the\n"
+"                              N most expensive at exit, 0 for none [0]\n"
+   );
+}
+
+static void dd_print_debug_usage(void)
+{
+   VG_(printf)(
+"    (none)\n"
+   );
+}
+
+static void dd_post_clo_init(void)
+{
+  while((1 << gran_shift) < clo_granularity){
+    gran_shift++;
+  }
+  page_label_bits = DD_LABEL_PAGE_BITS - gran_shift;
+  parse_globs(clo_sources, &source_globs);
+
+  if(clo_log_file != NULL){
+    open_log();
+  }
+
+  parse_globs(clo_trace_fn, &trace_fns);
+  parse_globs(clo_skip_fn, &skip_fns);
+  parse_globs(clo_skip_obj, &skip_objs);
+
+  if(clo_stats_interval > 0){
+    clo_stats = True;
+    next_stats_dump = clo_stats_interval;
+  }
+}
+
+
+// state used while instrumenting one superblock
+typedef struct {
+  IRSB* sb;          // the block being built
+  IRType hWordTy;
+  Bool replaced;      // this is code of a function replacement
+  Bool skipped;       // or ruled out by the filters, see is_skipped
+  IRExpr* summary;    // union of the registers a skipped block read
+  Int shadow_base;    // offset of the register shadows in the guest state
+  IRExpr* helpers_on; // Ity_I1 copy of helpers_on, NULL until used
+  Int offset_SP;      // of the stack pointer in the guest state
+  UInt mem_epoch;     // memory writes instrumented so far
+} DDEnv;
+
+// what we know about each temp of the block being instrumented. the
+// array is kept from block to block and only grows, and an entry only
+// counts if it carries the current generation, so starting a block is a
+// counter increment rather than clearing an entry per temp
+typedef struct {
+  UInt gen;
+  Bool may_taint;
+  Bool live;
+  Bool needs_shadow;        // may_taint && live, see find_shadowed_tmps
+  IRTemp shadow;            // the shadow temp, IRTemp_INVALID if clean
+  IRExpr* load_addr;        // the temp holds what was loaded from here,
+  UInt load_epoch;          // before memory write number load_epoch
+  UChar stack;              // STACK_ADDR or STACK_LOAD, in skipped blocks
+} TempInfo;
+
+static TempInfo* temps = NULL;
+static UInt temps_size = 0;
+static UInt temps_gen = 0;
+
+// forget every temp of the previous block
+static void start_temps(UInt n){
+  if(n > temps_size){
+    UInt new_size = (n > 2*temps_size)? n : 2*temps_size;
+    temps = VG_(realloc)("dd.temps", temps, new_size*sizeof(TempInfo));
+    VG_(memset)(temps + temps_size, 0, (new_size - temps_size)*sizeof(TempInfo));
+    temps_size = new_size;
+  }
+  if(++temps_gen == 0){
+    // wrapped, make sure no entry looks current
+    VG_(memset)(temps, 0, temps_size*sizeof(TempInfo));
+    temps_gen = 1;
+  }
+}
+
+static TempInfo* temp_info(IRTemp t){
+  TempInfo* ti = &temps[t];
+  if(ti->gen != temps_gen){
+    ti->gen = temps_gen;
+    ti->may_taint = False;
+    ti->live = False;
+    ti->needs_shadow = False;
+    ti->shadow = IRTemp_INVALID;
+    ti->load_addr = NULL;
+    ti->stack = 0;
+  }
+  return ti;
+}
+
+static Bool atom_may_taint(IRExpr* e){
+  return e != NULL && e->tag == Iex_RdTmp && temp_info(e->Iex.RdTmp.tmp)->may_taint;
+}
+
+static void mark_atom_live(IRExpr* e){
+  if(e != NULL && e->tag == Iex_RdTmp){
+    temp_info(e->Iex.RdTmp.tmp)->live = True;
+  }
+}
+
+// a temp needs a shadow only if it may carry taint, which means it is
+// computed (transitively) from a load or a register read, and if its
+// shadow is used, which means it flows into a register, into memory or
+// into an operation we do not model. everything else, such as constants
+// and address arithmetic, is provably clean or dead and gets no
+// instrumentation at all.
+static void find_shadowed_tmps(IRSB* sbIn){
+  Int n = sbIn->tyenv->types_used;
+  Int i;
+
+  // forward: which temps may carry taint
+  for(i = 0; i < sbIn->stmts_used; i++){
+    IRStmt* st = sbIn->stmts[i];
+    switch(st->tag){
+      case Ist_WrTmp:
+      {
+        IRExpr* e = st->Ist.WrTmp.data;
+        Bool t = False;
+        switch(e->tag){
+          case Iex_Get:
+          case Iex_GetI:
+          case Iex_Load:
+            t = True;
+            break;
+          case Iex_RdTmp:
+            t = atom_may_taint(e);
+            break;
+          case Iex_Unop:
+            t = atom_may_taint(e->Iex.Unop.arg);
+            break;
+          case Iex_Binop:
+            t = atom_may_taint(e->Iex.Binop.arg1)
+                || atom_may_taint(e->Iex.Binop.arg2);
+            break;
+          case Iex_Triop:
+            t = atom_may_taint(e->Iex.Triop.details->arg1)
+                || atom_may_taint(e->Iex.Triop.details->arg2)
+                || atom_may_taint(e->Iex.Triop.details->arg3);
+            break;
+          case Iex_Qop:
+            t = atom_may_taint(e->Iex.Qop.details->arg1)
+                || atom_may_taint(e->Iex.Qop.details->arg2)
+                || atom_may_taint(e->Iex.Qop.details->arg3)
+                || atom_may_taint(e->Iex.Qop.details->arg4);
+            break;
+          case Iex_ITE:
+            t = atom_may_taint(e->Iex.ITE.iftrue)
+                || atom_may_taint(e->Iex.ITE.iffalse);
+            break;
+          case Iex_CCall:
+            for(Int j = 0; e->Iex.CCall.args[j] != NULL; j++){
+              t = t || atom_may_taint(e->Iex.CCall.args[j]);
+            }
+            break;
+          default:
+            break;
+        }
+        temp_info(st->Ist.WrTmp.tmp)->may_taint = t;
         break;
       }
-      prev = curr;
-      curr = curr->next;
+      // temps written by these come from memory or from a helper
+      case Ist_LoadG:
+        temp_info(st->Ist.LoadG.details->dst)->may_taint = True;
+        break;
+      case Ist_CAS:
+        temp_info(st->Ist.CAS.details->oldLo)->may_taint = True;
+        if(st->Ist.CAS.details->oldHi != IRTemp_INVALID){
+          temp_info(st->Ist.CAS.details->oldHi)->may_taint = True;
+        }
+        break;
+      case Ist_LLSC:
+        temp_info(st->Ist.LLSC.result)->may_taint = True;
+        break;
+      case Ist_Dirty:
+        if(st->Ist.Dirty.details->tmp != IRTemp_INVALID){
+          temp_info(st->Ist.Dirty.details->tmp)->may_taint = True;
+        }
+        break;
+      default:
+        break;
     }
+  }
 
-    if(!found){
-      prev->next = new_node;
+  // backward: which shadows are used. addresses and guards are not
+  // data dependences so they do not make a temp live
+  for(i = sbIn->stmts_used-1; i >= 0; i--){
+    IRStmt* st = sbIn->stmts[i];
+    switch(st->tag){
+      case Ist_Put:
+        mark_atom_live(st->Ist.Put.data);
+        break;
+      case Ist_PutI:
+        mark_atom_live(st->Ist.PutI.details->data);
+        break;
+      case Ist_Store:
+        mark_atom_live(st->Ist.Store.data);
+        break;
+      case Ist_StoreG:
+        mark_atom_live(st->Ist.StoreG.details->data);
+        break;
+      case Ist_LoadG:
+        mark_atom_live(st->Ist.LoadG.details->alt);
+        break;
+      case Ist_CAS:
+        mark_atom_live(st->Ist.CAS.details->dataLo);
+        mark_atom_live(st->Ist.CAS.details->dataHi);
+        break;
+      case Ist_LLSC:
+        mark_atom_live(st->Ist.LLSC.storedata);
+        break;
+      case Ist_Dirty:
+        for(Int j = 0; st->Ist.Dirty.details->args[j] != NULL; j++){
+          mark_atom_live(st->Ist.Dirty.details->args[j]);
+        }
+        break;
+      case Ist_WrTmp:
+      {
+        IRExpr* e = st->Ist.WrTmp.data;
+        if(!temp_info(st->Ist.WrTmp.tmp)->live){
+          break;
+        }
+        switch(e->tag){
+          case Iex_RdTmp:
+            mark_atom_live(e);
+            break;
+          case Iex_Unop:
+            mark_atom_live(e->Iex.Unop.arg);
+            break;
+          case Iex_Binop:
+            mark_atom_live(e->Iex.Binop.arg1);
+            mark_atom_live(e->Iex.Binop.arg2);
+            break;
+          case Iex_Triop:
+            mark_atom_live(e->Iex.Triop.details->arg1);
+            mark_atom_live(e->Iex.Triop.details->arg2);
+            mark_atom_live(e->Iex.Triop.details->arg3);
+            break;
+          case Iex_Qop:
+            mark_atom_live(e->Iex.Qop.details->arg1);
+            mark_atom_live(e->Iex.Qop.details->arg2);
+            mark_atom_live(e->Iex.Qop.details->arg3);
+            mark_atom_live(e->Iex.Qop.details->arg4);
+            break;
+          case Iex_ITE:
+            mark_atom_live(e->Iex.ITE.iftrue);
+            mark_atom_live(e->Iex.ITE.iffalse);
+            break;
+          case Iex_CCall:
+            for(Int j = 0; e->Iex.CCall.args[j] != NULL; j++){
+              mark_atom_live(e->Iex.CCall.args[j]);
+            }
+            break;
+          default:
+            break;
+        }
+        break;
+      }
+      default:
+        break;
     }
   }
 
+  for(i = 0; i < n; i++){
+    TempInfo* ti = temp_info(i);
+    ti->needs_shadow = ti->may_taint && ti->live;
+  }
+}
+
+// bind 'e' to a fresh temp, the instrumented IR has to stay flat
+static IRExpr* assign_new(DDEnv* env, IRType ty, IRExpr* e){
+  IRTemp t = newIRTemp(env->sb->tyenv, ty);
+  addStmtToIRSB(env->sb, IRStmt_WrTmp(t, e));
+  return IRExpr_RdTmp(t);
+}
+
+// host word sized binop
+static IRExpr* word_binop(DDEnv* env, IROp op32, IROp op64, IRExpr* a, IRExpr* b){
+  IROp op = (env->hWordTy == Ity_I64)? op64 : op32;
+  return assign_new(env, env->hWordTy, IRExpr_Binop(op, a, b));
+}
+
+static IRExpr* word_shr(DDEnv* env, IRExpr* a, UInt n){
+  return word_binop(env, Iop_Shr32, Iop_Shr64, a, IRExpr_Const(IRConst_U8(n)));
+}
+
+static IRExpr* word_shl(DDEnv* env, IRExpr* a, UInt n){
+  return word_binop(env, Iop_Shl32, Iop_Shl64, a, IRExpr_Const(IRConst_U8(n)));
 }
 
-// free a node
-static void free_addr_node(AddrNode* node){
+static IRExpr* word_and(DDEnv* env, IRExpr* a, HWord mask){
+  return word_binop(env, Iop_And32, Iop_And64, a, mkIRExpr_HWord(mask));
+}
 
-  if(node->next!=NULL){
-    free_addr_node(node->next);
-  }
-  VG_(free)(node);
+static IRExpr* word_add(DDEnv* env, IRExpr* a, IRExpr* b){
+  return word_binop(env, Iop_Add32, Iop_Add64, a, b);
 }
 
-// free the complete list
-static void free_addr_list(AddrList* list){
-  if(list->head!=NULL){
-    //VG_(printf)("head is not null\n");
-    free_addr_node(list->head);
+// shadow memory, and the counters and flags the instrumentation reads,
+// are host data, so they are accessed in the host byte order
+#if defined(VG_BIGENDIAN)
+#define HOST_END Iend_BE
+#else
+#define HOST_END Iend_LE
+#endif
+
+// set ids are 32 bits but helper arguments and results are host words
+static IRExpr* id_to_word(DDEnv* env, IRExpr* id){
+  if(env->hWordTy == Ity_I32){
+    return id;
   }
-  
-  //VG_(free)(list);
+  return assign_new(env, Ity_I64, IRExpr_Unop(Iop_32Uto64, id));
 }
 
-//add all the nodes of l2 list to l1
-static void merge_addr_lists(AddrList* l1, AddrList* l2){
-  
-  if(l2->head != NULL){
+static IRExpr* word_to_id(DDEnv* env, IRExpr* w){
+  if(env->hWordTy == Ity_I32){
+    return w;
+  }
+  return assign_new(env, Ity_I32, IRExpr_Unop(Iop_64to32, w));
+}
 
-    AddrNode* curr = l2->head;
+static IRExpr* mk_id(SetId id){
+  return IRExpr_Const(IRConst_U32(id));
+}
 
-    while(curr != NULL){
+// helpers_on is read once per block. it can not change under us: taint
+// only appears when a source is read, which happens in a syscall, and
+// taint_present is only cleared between blocks
+static IRExpr* emit_helpers_on(DDEnv* env){
+  if(env->helpers_on == NULL){
+    IRExpr* flag = assign_new(env, Ity_I32,
+                     IRExpr_Load(HOST_END, Ity_I32, mkIRExpr_HWord((HWord)&helpers_on)));
+    env->helpers_on = assign_new(env, Ity_I1,
+                        IRExpr_Binop(Iop_CmpNE32, flag, mk_id(0)));
+  }
+  return env->helpers_on;
+}
 
-      update_addr_list(l1, curr->addr);
+// add a helper call to the block, gated on helpers_on. a call with a
+// guard of its own runs when both hold: guards such as a private
+// secondary or a page crossing access can be true with nothing tainted
+static void add_dirty(DDEnv* env, IRDirty* dirty){
+  IRExpr* on = emit_helpers_on(env);
+  if(dirty->guard->tag == Iex_Const){
+    dirty->guard = on;
+  }
+  else if(dirty->guard != on){
+    IRExpr* w = assign_new(env, Ity_I32, IRExpr_Binop(Iop_And32,
+                  assign_new(env, Ity_I32, IRExpr_Unop(Iop_1Uto32, dirty->guard)),
+                  assign_new(env, Ity_I32, IRExpr_Unop(Iop_1Uto32, on))));
+    dirty->guard = assign_new(env, Ity_I1, IRExpr_Binop(Iop_CmpNE32, w, mk_id(0)));
+  }
+  addStmtToIRSB(env->sb, IRStmt_Dirty(dirty));
+}
 
-      curr = curr->next;
-    }
+// increment '*counter' when 'guard' holds (NULL for always)
+static void emit_inc(DDEnv* env, ULong* counter, IRExpr* guard){
+  IRExpr* addr = mkIRExpr_HWord((HWord)counter);
+  IRExpr* n = assign_new(env, Ity_I64, IRExpr_Binop(Iop_Add64,
+                assign_new(env, Ity_I64, IRExpr_Load(HOST_END, Ity_I64, addr)),
+                IRExpr_Const(IRConst_U64(1))));
+  if(guard == NULL){
+    addStmtToIRSB(env->sb, IRStmt_Store(HOST_END, addr, n));
+  }
+  else{
+    addStmtToIRSB(env->sb, IRStmt_StoreG(HOST_END, addr, n, guard));
   }
 }
 
+// with --dd-stats, count one more 'k'
+static void emit_count(DDEnv* env, Stat k, IRExpr* guard){
+  if(clo_stats){
+    emit_inc(env, &stats[k], guard);
+  }
+}
 
+// find the entries of main and exit the first time they are translated.
+// control can only arrive at a function entry through a call or a jump,
+// which starts one of the (at most three) extents of the block, so only
+// those are looked up, and nothing is looked up once both are known
+static void resolve_trace_points(const VexGuestExtents* vge){
+  if(trace_by_client || (trace_start_addr != 0 && trace_stop_addr != 0)){
+    return;
+  }
+  for(Int k = 0; k < vge->n_used; k++){
+    const HChar* fnname;
+    if(VG_(get_fnname_if_entry)(vge->base[k], &fnname)){
+      if(VG_(strcmp)(fnname, "main")==0){
+        trace_start_addr = vge->base[k];
+      }
+      else if(VG_(strcmp)(fnname, "exit")==0){
+        trace_stop_addr = vge->base[k];
+      }
+    }
+  }
+}
 
-// ananlysis variables
-static AddrList** table;
-static AddrList* tempshadow;
-static Bool trace = False; // this is true when the analysis is started from main
+// is the block part of one of our function replacements? they are told
+// by their object, vgpreload_ddtector-<platform>.so, since
+// VG_(get_fnname) gives their symbols demangled, as the names of the
+// functions they replace
+static Bool is_replacement(const VexGuestExtents* vge){
+  const HChar* objname;
+  return VG_(get_objname)(vge->base[0], &objname)
+         && VG_(strstr)(objname, "vgpreload_ddtector") != NULL;
+}
 
-// aditional instrumentation functions
+// inline lookup of the secondary map holding the shadow of 'addr'. this
+// is get_sm() written in IR: two loads and no branches, since untouched
+// parts of the map point at the clean maps rather than being NULL
+static IRExpr* emit_get_sm(DDEnv* env, IRExpr* addr){
+  UInt word_shift = (env->hWordTy == Ity_I64)? 3 : 2;
 
+  IRExpr* pidx = word_and(env, word_shr(env, addr, MID_BITS + SM_BITS), PRIMARY_SIZE-1);
+  IRExpr* pent = word_add(env, mkIRExpr_HWord((HWord)&primary_map[0]),
+                          word_shl(env, pidx, word_shift));
+  IRExpr* mid = assign_new(env, env->hWordTy, IRExpr_Load(HOST_END, env->hWordTy, pent));
 
-// get the list of addresses which taints 'addr'
-static AddrList* get_shadow_mem(Addr addr){
-    Int up = (((addr)&(0xFFFF0000))>>16);
-    AddrList* loopkup = table[up];
-    AddrList* ret = NULL;
-    if(loopkup!=NULL){
-        
-        Int low = (addr)&(0x0000FFFF);
-        ret = &loopkup[low];
-    }
-    return ret;
-}
-
-// set 'addr' as tainted by 'tainted_by'
-static void set_shadow_mem(Addr addr, Addr tainted_by){
-    //VG_(printf)("setting shadow mem for %lx as tainted by %lx\n",addr, tainted_by);
-    Int up = (((addr)&(0xFFFF0000))>>16);
-    //VG_(printf)("up value = %x\n", up);
-    AddrList* lookup = table[up];
-    // on demand allocation
-    if(lookup == NULL){
-        //VG_(printf)("lookup is NULL\n");
-        table[up] = (AddrList*)VG_(malloc)("Memory shadow", 0xFFFF*sizeof(AddrList));
-        for(ULong i = 0; i < 0xFFFF; i++){
-          table[up][i].head = NULL;
-        }
-        lookup = table[up];
-    }
-    Int low = (addr)&(0x0000FFFF);
-    update_addr_list(&lookup[low], tainted_by);
+  IRExpr* midx = word_and(env, word_shr(env, addr, SM_BITS), MID_SIZE-1);
+  IRExpr* ment = word_add(env, mid, word_shl(env, midx, word_shift));
+  return assign_new(env, env->hWordTy, IRExpr_Load(HOST_END, env->hWordTy, ment));
 }
 
-static AddrList* get_shadow_temp(IRTemp temp){
-    return (temp==-1)?NULL:&tempshadow[temp];
+static IRExpr* word_cmp(DDEnv* env, IROp op32, IROp op64, IRExpr* a, IRExpr* b){
+  IROp op = (env->hWordTy == Ity_I64)? op64 : op32;
+  return assign_new(env, Ity_I1, IRExpr_Binop(op, a, b));
 }
 
-static void set_shadow_temp(IRTemp temp, AddrList tainted_by){
-    tempshadow[temp] = tainted_by;
+static IRExpr* word_to_i8(DDEnv* env, IRExpr* w){
+  return assign_new(env, Ity_I8,
+                    IRExpr_Unop((env->hWordTy == Ity_I64)? Iop_64to8 : Iop_32to8, w));
 }
 
-static VG_REGPARM(2) void dd_put_reg(Int offset, Int tmp){
-
-    //VG_(printf)("dd_put call ==> offset = %x, tmp = %x\n", offset, tmp);
-    
-    ThreadId tid = VG_(get_running_tid)();
-    AddrList* shadow_reg = get_shadow_temp(tmp);
-    // TODO : verify the sizeof here
-    if(shadow_reg!=NULL){
-      VG_(set_shadow_regs_area)(tid, 1,offset, sizeof(AddrList*), (const UChar*)(&shadow_reg));
-    }
-    
+// a && b, or a || b with Iop_Or32, for two Ity_I1 atoms. either may be
+// NULL, which stands for true
+static IRExpr* emit_cond(DDEnv* env, IROp op32, IRExpr* a, IRExpr* b){
+  if(a == NULL || b == NULL){
+    return (op32 == Iop_And32)? ((a == NULL)? b : a) : NULL;
+  }
+  IRExpr* w = assign_new(env, Ity_I32, IRExpr_Binop(op32,
+                assign_new(env, Ity_I32, IRExpr_Unop(Iop_1Uto32, a)),
+                assign_new(env, Ity_I32, IRExpr_Unop(Iop_1Uto32, b))));
+  return assign_new(env, Ity_I1, IRExpr_Binop(Iop_CmpNE32, w, mk_id(0)));
 }
 
-static VG_REGPARM(2) void dd_get_reg(Int offset, Int tmp){
+static IRExpr* emit_not(DDEnv* env, IRExpr* a){
+  return assign_new(env, Ity_I1, IRExpr_Unop(Iop_Not1, a));
+}
 
+static IRExpr* emit_tainted(DDEnv* env, IRExpr* shadow){
+  return assign_new(env, Ity_I1, IRExpr_Binop(Iop_CmpNE32, shadow, mk_id(EMPTY_SET)));
+}
 
+// the most cells an access of 'size' bytes can touch
+static UInt max_cells(Int size){
+  return ((size + (1 << gran_shift) - 2) >> gran_shift) + 1;
+}
 
-  ThreadId tid = VG_(get_running_tid)();
-  Int addr_of_addr_list = 0;
+// where the shadow of an access of 'size' bytes at 'addr' starts: the
+// secondary, the index of the first cell in it, and whether the cells
+// may run past its end. 'cross' is NULL when that can not happen
+typedef struct {
+  IRExpr* sm;
+  IRExpr* idx;
+  IRExpr* cross;
+  IRExpr* n;          // cells touched, NULL when that is always 1
+} ShadowLoc;
+
+static ShadowLoc emit_shadow_loc(DDEnv* env, IRExpr* addr, Int size){
+  ShadowLoc loc;
+  IRExpr* cell = (gran_shift != 0)? word_shr(env, addr, gran_shift) : addr;
+  UInt n_max = max_cells(size);
+
+  loc.sm = emit_get_sm(env, cell);
+  loc.idx = word_and(env, cell, SM_SIZE-1);
+  loc.cross = NULL;
+  loc.n = NULL;
+  if(n_max > 1){
+    loc.cross = word_cmp(env, Iop_CmpLT32U, Iop_CmpLT64U,
+                         mkIRExpr_HWord(SM_SIZE - n_max), loc.idx);
+    IRExpr* last = word_add(env, addr, mkIRExpr_HWord(size - 1));
+    if(gran_shift != 0){
+      last = word_shr(env, last, gran_shift);
+    }
+    loc.n = word_binop(env, Iop_Sub32, Iop_Sub64, last, cell);
+    loc.n = word_add(env, loc.n, mkIRExpr_HWord(1));
+  }
+  return loc;
+}
 
-  //VG_(printf)("dd_get call ==> offset = %x, tmp = %x, type = %x\n", offset, tmp, ty);
-  ULong val = NULL;
-  VG_(get_shadow_regs_area)(tid, (UChar*)&val, 0, offset,sizeof(ULong));
+// bool mode: the address of the byte holding the bit of the first cell,
+// the index of that bit in it, and the mask of the bits of the access
+// relative to it
+static IRExpr* emit_bit_addr(DDEnv* env, ShadowLoc* loc, IRExpr** bit, IRExpr** mask){
+  *bit = word_to_i8(env, word_and(env, loc->idx, 7));
+  if(loc->n == NULL){
+    *mask = mkIRExpr_HWord(1);
+  }
+  else{
+    *mask = word_binop(env, Iop_Sub32, Iop_Sub64,
+              word_binop(env, Iop_Shl32, Iop_Shl64, mkIRExpr_HWord(1), word_to_i8(env, loc->n)),
+              mkIRExpr_HWord(1));
+  }
+  return word_add(env, loc->sm, word_shr(env, loc->idx, 3));
+}
 
+// the bits of an access are read and written a host word at a time, so
+// at most this many cells are handled inline. the bitmap is in bytes, and
+// the following bits are only the high bits of the word on little endian
+// hosts; big endian ones always call the helpers
+static Bool bits_fit(DDEnv* env, Int size){
+#if defined(VG_BIGENDIAN)
+  return False;
+#else
+  return max_cells(size) + 7 < 8*sizeofIRType(env->hWordTy);
+#endif
+}
 
+// the shadow of a load of 'size' bytes at 'addr', read inline. in bool
+// mode that is whether any of its cells is tainted. otherwise it is the
+// set of its first cell, and when the access spans more cells
+// dd_load_shadow computes the union, but only if they may be tainted,
+// that is if their secondary is not clean_sm. with a 'guard' (NULL for
+// always) the load may not happen; only the helper call is guarded,
+// since reading the shadow of any address is safe
+static IRExpr* emit_load_shadow(DDEnv* env, IRExpr* addr, Int size, IRExpr* guard){
+  IRExpr* slow;
+  IRExpr* fast;
+
+  emit_count(env, STAT_MEM_LOADS, guard);
+
+  if(bool_mode && !bits_fit(env, size)){
+    slow = guard;
+    fast = mk_id(EMPTY_SET);
+  }
+  else{
+    ShadowLoc loc = emit_shadow_loc(env, addr, size);
+
+    if(bool_mode){
+      IRExpr* bit;
+      IRExpr* mask;
+      IRExpr* b = emit_bit_addr(env, &loc, &bit, &mask);
+      IRExpr* w = assign_new(env, env->hWordTy, IRExpr_Load(HOST_END, env->hWordTy, b));
+      IRExpr* bits = word_binop(env, Iop_And32, Iop_And64,
+                       word_binop(env, Iop_Shr32, Iop_Shr64, w, bit), mask);
+      fast = assign_new(env, Ity_I32, IRExpr_Unop(Iop_1Uto32,
+               word_cmp(env, Iop_CmpNE32, Iop_CmpNE64, bits, mkIRExpr_HWord(0))));
+      slow = loc.cross;
+    }
+    else{
+      IRExpr* off = word_shl(env, loc.idx, 2);
+      fast = assign_new(env, Ity_I32,
+                        IRExpr_Load(HOST_END, Ity_I32, word_add(env, loc.sm, off)));
+      slow = NULL;
+      if(loc.cross != NULL){
+        IRExpr* private = word_cmp(env, Iop_CmpNE32, Iop_CmpNE64,
+                                   loc.sm, mkIRExpr_HWord((HWord)&clean_sm));
+        slow = emit_cond(env, Iop_Or32, private, loc.cross);
+      }
+    }
 
-  // copy the address of addr_list object to dst
-  VG_(get_shadow_regs_area)(tid, (UChar*)&addr_of_addr_list, 1, offset,sizeof(AddrList*));
+    if(slow == NULL){
+      return fast;
+    }
+    slow = emit_cond(env, Iop_And32, slow, guard);
+  }
 
-  // if there is a list update set the shadow temp
-  if(addr_of_addr_list != 0){
-    //VG_(printf)("setting shadow temp ===========\n");
-    set_shadow_temp(tmp, *(AddrList*)addr_of_addr_list);
+  IRTemp ret = newIRTemp(env->sb->tyenv, env->hWordTy);
+  IRDirty* dirty = unsafeIRDirty_1_N(ret, 2, "dd_load_shadow",
+                     VG_(fnptr_to_fnentry)(dd_load_shadow),
+                     mkIRExprVec_2(addr, mkIRExpr_HWord(size)));
+  if(slow != NULL){
+    dirty->guard = slow;
   }
-  
+  add_dirty(env, dirty);
+  return assign_new(env, Ity_I32, IRExpr_ITE(dirty->guard,
+                                             word_to_id(env, IRExpr_RdTmp(ret)), fast));
 }
 
-static VG_REGPARM(2) void dd_tmp_to_tmp(IRTemp rdtmp, IRTemp wrtmp){
-  // rdtmp can not be invalid
-  tl_assert(rdtmp!=-1);
-
-  AddrList* addr_list = get_shadow_temp(rdtmp);
-
-  if(addr_list!=NULL){
-    set_shadow_temp(wrtmp, *addr_list);
+// a store of 'size' bytes of a value with shadow 'shadow' to 'addr', if
+// 'guard' holds (NULL for always). stores add to the taint of memory,
+// storing an untainted value changes nothing.
+//
+// in bool mode the bits are or'ed in inline, with a guarded store,
+// unless the cells are still in clean_sm, which must stay clear, or run
+// into the next secondary; then dd_store_tmp_to_addr sets them
+static void emit_store_shadow(DDEnv* env, IRExpr* addr, Int size, IRExpr* shadow, IRExpr* guard){
+  emit_count(env, STAT_MEM_STORES, guard);
+  IRExpr* slow = emit_cond(env, Iop_And32, emit_tainted(env, shadow), guard);
+
+  if(bool_mode && bits_fit(env, size)){
+    ShadowLoc loc = emit_shadow_loc(env, addr, size);
+    IRExpr* bit;
+    IRExpr* mask;
+    IRExpr* b = emit_bit_addr(env, &loc, &bit, &mask);
+    IRExpr* old = assign_new(env, env->hWordTy, IRExpr_Load(HOST_END, env->hWordTy, b));
+    IRExpr* set = word_binop(env, Iop_Or32, Iop_Or64, old,
+                    word_binop(env, Iop_Shl32, Iop_Shl64, mask, bit));
+
+    IRExpr* ok = word_cmp(env, Iop_CmpNE32, Iop_CmpNE64,
+                          loc.sm, mkIRExpr_HWord((HWord)&clean_sm));
+    if(loc.cross != NULL){
+      ok = emit_cond(env, Iop_And32, ok, emit_not(env, loc.cross));
+    }
+    addStmtToIRSB(env->sb, IRStmt_StoreG(HOST_END, b, set, emit_cond(env, Iop_And32, slow, ok)));
+    slow = emit_cond(env, Iop_And32, slow, emit_not(env, ok));
   }
 
+  IRDirty* dirty = unsafeIRDirty_0_N(3, "dd_store_tmp_to_addr",
+                     VG_(fnptr_to_fnentry)(dd_store_tmp_to_addr),
+                     mkIRExprVec_3(addr, id_to_word(env, shadow), mkIRExpr_HWord(size)));
+  dirty->guard = slow;
+  add_dirty(env, dirty);
 }
 
-// funtions for handling ALU operations
-// Qop
-static VG_REGPARM(3) void dd_qop_to_tmp(IRTemp arg1, IRTemp arg2, IRTemp arg3, IRTemp arg4, IRTemp wrtmp){
-  //VG_(printf)("arg1 = %x, arg2 %x, arg3 = %x, arg4 = %x\n", arg1, arg2, arg3, arg4);
-  AddrList* addr_list_arg1 = get_shadow_temp(arg1);
-  AddrList* addr_list_arg2 = get_shadow_temp(arg2);
-  AddrList* addr_list_arg3 = get_shadow_temp(arg3);
-  AddrList* addr_list_arg4 = get_shadow_temp(arg4);
-
-  AddrList* addr_list_wrtmp = get_shadow_temp(wrtmp);
+// the same for a value that was loaded from 'src' and is stored
+// unchanged, see dd_store_copy
+static void emit_store_copy(DDEnv* env, IRExpr* dst, IRExpr* src, Int size,
+                            IRExpr* shadow){
+  emit_count(env, STAT_MEM_STORES, NULL);
+  IRDirty* dirty = unsafeIRDirty_0_N(3, "dd_store_copy",
+                     VG_(fnptr_to_fnentry)(dd_store_copy),
+                     mkIRExprVec_3(dst, src, mkIRExpr_HWord(size)));
+  dirty->guard = emit_tainted(env, shadow);
+  add_dirty(env, dirty);
+}
 
-  if(addr_list_arg1!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg1);
+// the shadow of an atom, or NULL when it is known to be untainted
+static IRExpr* shadow_of(DDEnv* env, IRExpr* e){
+  if(e == NULL || e->tag != Iex_RdTmp){
+    return NULL;
   }
-  if(addr_list_arg2!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg2);
+  IRTemp s = temp_info(e->Iex.RdTmp.tmp)->shadow;
+  return (s == IRTemp_INVALID)? NULL : IRExpr_RdTmp(s);
+}
+
+static void set_shadow_of(DDEnv* env, IRTemp tmp, IRExpr* shadow){
+  if(shadow == NULL){
+    temp_info(tmp)->shadow = IRTemp_INVALID;
   }
-  if(addr_list_arg3!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg3);
+  else if(shadow->tag == Iex_RdTmp){
+    temp_info(tmp)->shadow = shadow->Iex.RdTmp.tmp;
   }
-  if(addr_list_arg4!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg4);
+  else{
+    IRTemp t = assign_new(env, Ity_I32, shadow)->Iex.RdTmp.tmp;
+    temp_info(tmp)->shadow = t;
   }
-
-
 }
 
-// Triop
-static VG_REGPARM(3) void dd_triop_to_tmp(IRTemp arg1, IRTemp arg2, IRTemp arg3, IRTemp wrtmp){
-  AddrList* addr_list_arg1 = get_shadow_temp(arg1);
-  AddrList* addr_list_arg2 = get_shadow_temp(arg2);
-  AddrList* addr_list_arg3 = get_shadow_temp(arg3);
-
-  AddrList* addr_list_wrtmp = get_shadow_temp(wrtmp);
-
-  if(addr_list_arg1!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg1);
+// a U b for two shadows. when either side is empty or both are the same
+// set the answer is a | b, so dd_union is only called, through the dirty
+// guard, when both are tainted with different sets
+static IRExpr* emit_union(DDEnv* env, IRExpr* a, IRExpr* b){
+  if(a == NULL){
+    return b;
+  }
+  if(b == NULL){
+    return a;
   }
-  if(addr_list_arg2!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg2);
+  if(a->tag == Iex_RdTmp && b->tag == Iex_RdTmp && a->Iex.RdTmp.tmp == b->Iex.RdTmp.tmp){
+    return a;
   }
-  if(addr_list_arg3!=NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list_arg3);
+  emit_count(env, STAT_UNIONS, NULL);
+  if(bool_mode){
+    return assign_new(env, Ity_I32, IRExpr_Binop(Iop_Or32, a, b));
   }
 
+  IRExpr* both = assign_new(env, Ity_I32, IRExpr_Binop(Iop_And32,
+                   assign_new(env, Ity_I32, IRExpr_Unop(Iop_CmpwNEZ32, a)),
+                   assign_new(env, Ity_I32, IRExpr_Unop(Iop_CmpwNEZ32, b))));
+  IRExpr* diff = assign_new(env, Ity_I32, IRExpr_Binop(Iop_Xor32, a, b));
+  IRExpr* need = assign_new(env, Ity_I1, IRExpr_Binop(Iop_CmpNE32,
+                   assign_new(env, Ity_I32, IRExpr_Binop(Iop_And32, both, diff)),
+                   mk_id(EMPTY_SET)));
+
+  IRTemp ret = newIRTemp(env->sb->tyenv, env->hWordTy);
+  IRDirty* dirty = unsafeIRDirty_1_N(ret, 2, "dd_union", VG_(fnptr_to_fnentry)(dd_union),
+                     mkIRExprVec_2(id_to_word(env, a), id_to_word(env, b)));
+  dirty->guard = need;
+  add_dirty(env, dirty);
+
+  IRExpr* slow = word_to_id(env, IRExpr_RdTmp(ret));
+  IRExpr* fast = assign_new(env, Ity_I32, IRExpr_Binop(Iop_Or32, a, b));
+  return assign_new(env, Ity_I32, IRExpr_ITE(need, slow, fast));
 }
 
-// Binop
-static VG_REGPARM(3) void dd_binop_to_tmp(IRTemp arg1, IRTemp arg2, IRTemp wrtmp){
 
-  //VG_(printf)("arg1 = %x , arg2 = %x\n", arg1, arg2); 
-  AddrList* addr_list_arg1 = get_shadow_temp(arg1);
-  AddrList* addr_list_arg2 = get_shadow_temp(arg2);
+// the shadow of a register lives in the first shadow guest state, right
+// after the guest state itself. each aligned 4 byte slot holds the set id
+// of the bytes it covers
+static void emit_put_shadow(DDEnv* env, Int offset, Int size, IRExpr* shadow){
+  Int slot = offset & ~3;
 
-  AddrList* addr_list_wrtmp = get_shadow_temp(wrtmp);
-
-  if(addr_list_arg1!=NULL){
-    //VG_(printf)("MERGING1\n");
-    merge_addr_lists(/* list1 = */addr_list_wrtmp, /*list2 = */addr_list_arg1);
+  if(size < 4){
+    // a partial write keeps the taint of the rest of the slot
+    if(shadow == NULL){
+      return;
+    }
+    emit_count(env, STAT_REG_PUTS, NULL);
+    IRExpr* old = assign_new(env, Ity_I32, IRExpr_Get(env->shadow_base + slot, Ity_I32));
+    addStmtToIRSB(env->sb, IRStmt_Put(env->shadow_base + slot, emit_union(env, old, shadow)));
+    return;
   }
 
-  if(addr_list_arg2 != NULL){
-    //VG_(printf)("MERGING2\n");
-    merge_addr_lists(/* list1 = */addr_list_wrtmp, /*list2 = */addr_list_arg2);
+  emit_count(env, STAT_REG_PUTS, NULL);
+  for(; slot < offset + size; slot += 4){
+    addStmtToIRSB(env->sb, IRStmt_Put(env->shadow_base + slot,
+                                      (shadow == NULL)? mk_id(EMPTY_SET) : shadow));
   }
-
 }
 
-// Unop
-static VG_REGPARM(2) void dd_unop_to_tmp(IRTemp arg1, IRTemp wrtmp){
-
-  AddrList* addr_list_arg1 = get_shadow_temp(arg1);
-
-  AddrList* addr_list_wrtmp = get_shadow_temp(wrtmp);
-
-  if(addr_list_arg1!=NULL){
-    merge_addr_lists(/*list1 = */addr_list_wrtmp, /*list2=*/addr_list_arg1);
+// the union of the slots a Get covers. an 8 byte Get needs both of its
+// slots too: parts of vector registers are written a 4 byte lane at a
+// time and read 8 bytes at a time (CVTPI2PS writes lane 1, MOVQ reads
+// lanes 0 and 1). a whole register write puts the same set in every
+// slot, so the union then costs no helper call
+static IRExpr* emit_get_shadow(DDEnv* env, Int offset, Int size){
+  Int slot = offset & ~3;
+  emit_count(env, STAT_REG_GETS, NULL);
+  IRExpr* shadow = assign_new(env, Ity_I32, IRExpr_Get(env->shadow_base + slot, Ity_I32));
+
+  if(size > 4){
+    for(slot += 4; slot < offset + size; slot += 4){
+      shadow = emit_union(env, shadow,
+                 assign_new(env, Ity_I32, IRExpr_Get(env->shadow_base + slot, Ity_I32)));
+    }
   }
-
+  return shadow;
 }
 
-
-// load from address strored in a temp variable and assign it to a temp variable
-static VG_REGPARM(2) void dd_load_from_addr(Addr addr, IRTemp wrtmp){
-
-
-  AddrList* addr_list = get_shadow_mem(addr);
-
-  AddrList* addr_list_wrtmp = get_shadow_temp(wrtmp);
-
-  if(addr_list != NULL){
-    merge_addr_lists(addr_list_wrtmp, addr_list);
+// the shadow of a guest state array, for GetI and PutI. elements of 4 or
+// 8 bytes are shadowed by an array over their slots, with the set in
+// every slot. narrower ones (the x87 tags) share slots and are not data,
+// they get no shadow
+static IRRegArray* shadow_array(DDEnv* env, IRRegArray* descr){
+  Int size = sizeofIRType(descr->elemTy);
+  if((size != 4 && size != 8) || (descr->base & 3) != 0){
+    return NULL;
   }
-} 
-
-
-// print an addr list 
-static void print_addr_list(AddrList* l){
-
-  AddrNode* curr = l->head;
+  return mkIRRegArray(env->shadow_base + descr->base, (size == 4)? Ity_I32 : Ity_I64,
+                      descr->nElems);
+}
 
-  while(curr!=NULL){
-    Addr curr_addr = curr->addr;
-    VG_(printf)("[0x%08lx:%08x] ", curr_addr, *(UChar*)(curr_addr));
-    
-    curr = curr->next;
+static IRExpr* emit_get_shadow_i(DDEnv* env, IRRegArray* descr, IRExpr* ix, Int bias){
+  IRRegArray* arr = shadow_array(env, descr);
+  if(arr == NULL){
+    return NULL;
   }
-
+  emit_count(env, STAT_REG_GETS, NULL);
+  IRExpr* v = assign_new(env, arr->elemTy, IRExpr_GetI(arr, ix, bias));
+  if(arr->elemTy == Ity_I64){
+    v = assign_new(env, Ity_I32, IRExpr_Unop(Iop_64to32, v));
+  }
+  return v;
 }
 
-// print all the nodes in an addres list
-static void print_and_propagate_addr_list(IRExpr* addr, AddrList* l){
-
-  if(l!=NULL){
-    if(l->head != NULL){
-      AddrNode* curr = l->head;
-
-      while(curr!=NULL){
-        
+static void emit_put_shadow_i(DDEnv* env, IRRegArray* descr, IRExpr* ix, Int bias,
+                              IRExpr* shadow){
+  IRRegArray* arr = shadow_array(env, descr);
+  if(arr == NULL){
+    return;
+  }
+  emit_count(env, STAT_REG_PUTS, NULL);
+  IRExpr* v = (shadow == NULL)? mk_id(EMPTY_SET) : shadow;
+  if(arr->elemTy == Ity_I64){
+    v = assign_new(env, Ity_I64, IRExpr_Binop(Iop_32HLto64, v, v));
+  }
+  addStmtToIRSB(env->sb, IRStmt_PutI(mkIRPutI(arr, ix, bias, v)));
+}
 
-        set_shadow_mem(addr, (Addr)curr->addr);
+// the value of a store came straight from a load in this block, with no
+// memory write in between, so its shadow can be copied cell by cell.
+// only worth it when the value spans more than one cell
+static IRExpr* loaded_from(DDEnv* env, IRExpr* data, Int size){
+  if(bool_mode || data->tag != Iex_RdTmp || max_cells(size) == 1){
+    return NULL;
+  }
+  TempInfo* ti = temp_info(data->Iex.RdTmp.tmp);
+  return (ti->load_epoch == env->mem_epoch)? ti->load_addr : NULL;
+}
 
-        curr = curr->next;
+// a helper call with side effects. its result, the registers and the
+// memory it writes all get the union of the shadows of its arguments
+// and of the registers and memory it reads. the call may be guarded, so
+// what it writes only adds to the taint already there
+static void instrument_dirty(DDEnv* env, IRDirty* d){
+  IRExpr* shadow = NULL;
+  Bool guarded = !(d->guard->tag == Iex_Const && d->guard->Iex.Const.con->Ico.U1);
+  IRExpr* guard = guarded? d->guard : NULL;
+  Int i, k;
+
+  for(i = 0; d->args[i] != NULL; i++){
+    shadow = emit_union(env, shadow, shadow_of(env, d->args[i]));
+  }
+  for(i = 0; i < d->nFxState; i++){
+    if(d->fxState[i].fx == Ifx_Read || d->fxState[i].fx == Ifx_Modify){
+      for(k = 0; k <= d->fxState[i].nRepeats; k++){
+        shadow = emit_union(env, shadow,
+                   emit_get_shadow(env, d->fxState[i].offset + k*d->fxState[i].repeatLen,
+                                   d->fxState[i].size));
       }
+    }
+  }
+  if(d->mFx == Ifx_Read || d->mFx == Ifx_Modify){
+    shadow = emit_union(env, shadow, emit_load_shadow(env, d->mAddr, d->mSize, guard));
+  }
 
-      print_addr_list(l);
-
+  if(d->tmp != IRTemp_INVALID){
+    set_shadow_of(env, d->tmp, shadow);
+  }
+  for(i = 0; i < d->nFxState; i++){
+    if(d->fxState[i].fx == Ifx_Write || d->fxState[i].fx == Ifx_Modify){
+      for(k = 0; k <= d->fxState[i].nRepeats; k++){
+        Int offset = d->fxState[i].offset + k*d->fxState[i].repeatLen;
+        IRExpr* s = shadow;
+        if(guarded && s != NULL){
+          s = emit_union(env, emit_get_shadow(env, offset, d->fxState[i].size),
+                         assign_new(env, Ity_I32, IRExpr_ITE(d->guard, s, mk_id(EMPTY_SET))));
+        }
+        else if(guarded){
+          continue;
+        }
+        emit_put_shadow(env, offset, d->fxState[i].size, s);
+      }
     }
   }
+  if(shadow != NULL && (d->mFx == Ifx_Write || d->mFx == Ifx_Modify)){
+    emit_store_shadow(env, d->mAddr, d->mSize, shadow, guard);
+  }
+  if(d->mFx == Ifx_Write || d->mFx == Ifx_Modify){
+    env->mem_epoch++;
+  }
 }
 
-
-
-// store instruction 
-static VG_REGPARM(2) void dd_store_tmp_to_addr(IRExpr* addr, IRTemp data){
-
-  // here we print the provanence
-  AddrList* addr_list_data = get_shadow_temp(data);
-
-  if(addr_list_data != NULL ){
-    VG_(printf)("0x%08lx [DD]: ", addr);
-
-    print_and_propagate_addr_list(addr, addr_list_data);
-
-    VG_(printf)("\n");
-
-
-
+// the equality of an old value of a CAS with the expected one
+static IRExpr* emit_cas_eq(DDEnv* env, IRTemp old, IRExpr* expd){
+  IROp op;
+  switch(typeOfIRExpr(env->sb->tyenv, expd)){
+    case Ity_I8:  op = Iop_CmpEQ8;  break;
+    case Ity_I16: op = Iop_CmpEQ16; break;
+    case Ity_I32: op = Iop_CmpEQ32; break;
+    default:      op = Iop_CmpEQ64; break;
   }
-
+  return assign_new(env, Ity_I1, IRExpr_Binop(op, IRExpr_RdTmp(old), expd));
 }
 
+// a write of 'size' bytes at 'addr' by skipped code, if 'guard' holds
+// (NULL for always). with --dd-skip-model=clear dd_clear_shadow clears
+// the shadow, but only when the bytes may be tainted, that is if their
+// secondary is not clean_sm
+static void emit_skipped_store(DDEnv* env, IRExpr* addr, Int size, IRExpr* guard){
+  if(!skip_clear){
+    if(env->summary != NULL){
+      emit_store_shadow(env, addr, size, env->summary, guard);
+    }
+    return;
+  }
 
-//syscall handlers
-static void dd_pre_call(ThreadId tid, UInt syscallno,
-                                    UWord* args, UInt nArgs){
+  IRExpr* slow = NULL;
+  if(max_cells(size) < SM_SIZE){
+    ShadowLoc loc = emit_shadow_loc(env, addr, size);
+    slow = emit_cond(env, Iop_Or32,
+                     word_cmp(env, Iop_CmpNE32, Iop_CmpNE64,
+                              loc.sm, mkIRExpr_HWord((HWord)&clean_sm)),
+                     loc.cross);
+  }
+  slow = emit_cond(env, Iop_And32, slow, guard);
 
+  IRDirty* dirty = unsafeIRDirty_0_N(2, "dd_clear_shadow",
+                     VG_(fnptr_to_fnentry)(dd_clear_shadow),
+                     mkIRExprVec_2(addr, mkIRExpr_HWord(size)));
+  if(slow != NULL){
+    dirty->guard = slow;
+  }
+  add_dirty(env, dirty);
 }
 
-static void dd_post_call(ThreadId tid, UInt syscallno,
-                                    UWord* args, UInt nArgs, SysRes res){
-    if(trace){
-        if(syscallno==__NR_read){
-            // read syscall args : fd, buffer address, size 
-            //VG_(printf)("read %d %x %d\n",args[0], args[1],args[2]);
-            Int i;
-            for(i=0; i < args[2];i++){
-              //VG_(printf)("addr %08lx : %08lx\n", args[1]+i, args[1]+i);
-              set_shadow_mem(args[1]+i, args[1]+i);
-
-              // print the DDs
-              AddrList* addr_l = get_shadow_mem(args[1]+i);
-              if(addr_l!=NULL){
-                VG_(printf)("0x%08lx [DD]: ", args[1]+i);
-                print_addr_list(addr_l);
-                VG_(printf)("\n");
-              }
+// temps of a skipped block holding the stack pointer plus a constant,
+// and values loaded from there
+#define STACK_ADDR 1
+#define STACK_LOAD 2
 
-            }
-        }
-    }
+static Bool is_stack_tmp(IRExpr* e, UChar what){
+  return e->tag == Iex_RdTmp && temp_info(e->Iex.RdTmp.tmp)->stack == what;
 }
 
-static void dd_post_clo_init(void)
-{
+// the summary model of a block ruled out by the filters. its temps are
+// not shadowed and nothing runs per ALU operation or load. with
+// --dd-skip-model=taint every register and memory it writes gets the
+// union of the registers it read, the arguments of the code as far as
+// a block can tell, and memory it loaded does not count. with clear they
+// are cleared. a register loaded from the stack keeps its shadow
+// instead: that is how callee saved registers are restored, and their
+// taint is the caller's
+static void instrument_skipped(DDEnv* env, IRStmt* st){
+  switch(st->tag){
+    case Ist_WrTmp:
+      {
+        IRExpr* data = st->Ist.WrTmp.data;
+        TempInfo* ti = temp_info(st->Ist.WrTmp.tmp);
+        if(data->tag == Iex_Get && data->Iex.Get.offset == env->offset_SP){
+          ti->stack = STACK_ADDR;
+        }
+        else if(data->tag == Iex_Binop
+                && (data->Iex.Binop.op == Iop_Add32 || data->Iex.Binop.op == Iop_Add64
+                    || data->Iex.Binop.op == Iop_Sub32 || data->Iex.Binop.op == Iop_Sub64)
+                && is_stack_tmp(data->Iex.Binop.arg1, STACK_ADDR)
+                && data->Iex.Binop.arg2->tag == Iex_Const){
+          ti->stack = STACK_ADDR;
+        }
+        else if(data->tag == Iex_Load && is_stack_tmp(data->Iex.Load.addr, STACK_ADDR)){
+          ti->stack = STACK_LOAD;
+        }
+        if(skip_clear){
+          break;
+        }
+        if(data->tag == Iex_Get){
+          env->summary = emit_union(env, env->summary,
+                           emit_get_shadow(env, data->Iex.Get.offset,
+                                           sizeofIRType(data->Iex.Get.ty)));
+        }
+        else if(data->tag == Iex_GetI){
+          env->summary = emit_union(env, env->summary,
+                           emit_get_shadow_i(env, data->Iex.GetI.descr,
+                                             data->Iex.GetI.ix, data->Iex.GetI.bias));
+        }
+      }
+      break;
+    case Ist_Put:
+      if(!is_stack_tmp(st->Ist.Put.data, STACK_LOAD)){
+        emit_put_shadow(env, st->Ist.Put.offset,
+                        sizeofIRType(typeOfIRExpr(env->sb->tyenv, st->Ist.Put.data)),
+                        env->summary);
+      }
+      break;
+    case Ist_PutI:
+      {
+        IRPutI* puti = st->Ist.PutI.details;
+        emit_put_shadow_i(env, puti->descr, puti->ix, puti->bias, env->summary);
+      }
+      break;
+    case Ist_Store:
+      emit_skipped_store(env, st->Ist.Store.addr,
+                         sizeofIRType(typeOfIRExpr(env->sb->tyenv, st->Ist.Store.data)),
+                         NULL);
+      break;
+    case Ist_StoreG:
+      {
+        IRStoreG* sg = st->Ist.StoreG.details;
+        emit_skipped_store(env, sg->addr, sizeofIRType(typeOfIRExpr(env->sb->tyenv, sg->data)),
+                           sg->guard);
+      }
+      break;
+    case Ist_CAS:
+      {
+        IRCAS* cas = st->Ist.CAS.details;
+        Int size = sizeofIRType(typeOfIRExpr(env->sb->tyenv, cas->dataLo));
+        addStmtToIRSB(env->sb, st);
+        IRExpr* done = emit_cas_eq(env, cas->oldLo, cas->expdLo);
+        if(cas->oldHi != IRTemp_INVALID){
+          done = emit_cond(env, Iop_And32, done, emit_cas_eq(env, cas->oldHi, cas->expdHi));
+          size *= 2;
+        }
+        emit_skipped_store(env, cas->addr, size, done);
+      }
+      return;
+    case Ist_LLSC:
+      if(st->Ist.LLSC.storedata != NULL){
+        addStmtToIRSB(env->sb, st);
+        emit_skipped_store(env, st->Ist.LLSC.addr,
+                           sizeofIRType(typeOfIRExpr(env->sb->tyenv, st->Ist.LLSC.storedata)),
+                           IRExpr_RdTmp(st->Ist.LLSC.result));
+        return;
+      }
+      break;
+    case Ist_Dirty:
+      {
+        IRDirty* d = st->Ist.Dirty.details;
+        Bool guarded = !(d->guard->tag == Iex_Const && d->guard->Iex.Const.con->Ico.U1);
+        for(Int i = 0; i < d->nFxState; i++){
+          if(guarded || d->fxState[i].fx == Ifx_Read){
+            continue;
+          }
+          for(Int k = 0; k <= d->fxState[i].nRepeats; k++){
+            emit_put_shadow(env, d->fxState[i].offset + k*d->fxState[i].repeatLen,
+                            d->fxState[i].size, env->summary);
+          }
+        }
+        if(d->mFx == Ifx_Write || d->mFx == Ifx_Modify){
+          emit_skipped_store(env, d->mAddr, d->mSize, guarded? d->guard : NULL);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+  addStmtToIRSB(env->sb, st);
 }
 
-
 static
 IRSB* dd_instrument ( VgCallbackClosure* closure,
                       IRSB* sbIn,
@@ -422,6 +3948,7 @@ IRSB* dd_instrument ( VgCallbackClosure* closure,
   Int        i;
   IRSB*      sbOut;
   IRDirty*   dirty;
+  DDEnv      env;
 
   if (gWordTy != hWordTy) {
     /* We don't currently support this case. */
@@ -430,6 +3957,37 @@ IRSB* dd_instrument ( VgCallbackClosure* closure,
 
   /* Set up SB */
   sbOut = deepCopyIRSBExceptStmts(sbIn);
+  env.sb = sbOut;
+  env.hWordTy = hWordTy;
+  env.helpers_on = NULL;
+  env.shadow_base = layout->total_sizeB;
+  env.offset_SP = layout->offset_SP;
+  env.mem_epoch = 0;
+
+  if(guest_state_sizeB == 0){
+    guest_state_sizeB = layout->total_sizeB;
+    shadow_regs_buf = VG_(malloc)("dd.shadow_regs_buf", guest_state_sizeB);
+  }
+
+  // every temp of sbIn starts out untainted
+  start_temps(sbIn->tyenv->types_used);
+  n_sbs_instrumented++;
+
+  resolve_trace_points(vge);
+
+  // the function replacements in dd_replace_strmem.c move the shadow of
+  // their buffers themselves, so their code is left alone and none of
+  // their temps is shadowed. registers they write are cleared by the
+  // Puts below
+  env.replaced = is_replacement(vge);
+  env.skipped = !env.replaced && is_skipped(vge);
+  env.summary = NULL;
+  if(env.skipped){
+    n_sbs_skipped++;
+  }
+  else if(!env.replaced){
+    find_shadowed_tmps(sbIn);
+  }
 
   // Copy verbatim any IR preamble preceding the first IMark
   i = 0;
@@ -438,273 +3996,318 @@ IRSB* dd_instrument ( VgCallbackClosure* closure,
     i++;
   }
 
+  if(clo_profile > 0){
+    FnProfile* f = get_fn_profile(vge->base[0]);
+    addStmtToIRSB(sbOut, IRStmt_Store(HOST_END, mkIRExpr_HWord((HWord)&cur_fn),
+                                      mkIRExpr_HWord((HWord)f)));
+    emit_inc(&env, &f->blocks, NULL);
+  }
+
   for(;i < sbIn->stmts_used; i++){
     IRStmt* st = sbIn->stmts[i];
     
     if (!st || st->tag == Ist_NoOp) continue;
 
-    const HChar* fnname;
+    if(env.skipped && st->tag != Ist_IMark){
+      instrument_skipped(&env, st);
+      continue;
+    }
+
     switch(st->tag){
         case Ist_IMark:
 
-            if(VG_(get_fnname_if_entry)(st->Ist.IMark.addr, &fnname)){
-                if(VG_(strcmp)(fnname, "main")==0){
-                    trace = True;
-                }
-                else if(VG_(strcmp)(fnname, "exit")==0){
-                    trace = False;
-                }
-            }
             addStmtToIRSB(sbOut, st);
+
+            // tracing is switched when main or exit is entered, at run time,
+            // so translations do not depend on where we were when they were made
+            if(st->Ist.IMark.addr == trace_start_addr){
+                dirty = unsafeIRDirty_0_N(0, "dd_trace_start", VG_(fnptr_to_fnentry)(dd_trace_start), mkIRExprVec_0());
+                addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+            }
+            else if(st->Ist.IMark.addr == trace_stop_addr){
+                dirty = unsafeIRDirty_0_N(0, "dd_trace_stop", VG_(fnptr_to_fnentry)(dd_trace_stop), mkIRExprVec_0());
+                addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+            }
             break;
         case Ist_Put:
 
             // put some value in to guest register
-            if(trace){
+            {
               //VG_(printf)("Ist_Put\n");
-              Int offset = st->Ist.Put.offset;
               IRExpr* data = st->Ist.Put.data;
-
-              //VG_(printf)("offset = %x , data = %lx, data tag = %x\n", offset, (SizeT)data, data->tag);
-              
-              IRExpr** argv = mkIRExprVec_2(mkIRExpr_HWord((HWord)offset),
-                      mkIRExpr_HWord( (HWord) (data->tag == Iex_RdTmp)?(data->Iex.RdTmp.tmp):-1));
-              
-              dirty = unsafeIRDirty_0_N(2, "dd_put_reg", VG_(fnptr_to_fnentry)(dd_put_reg), argv);
-              
-              addStmtToIRSB(sbOut,IRStmt_Dirty(dirty)); 
-
-            
+              emit_put_shadow(&env, st->Ist.Put.offset,
+                              sizeofIRType(typeOfIRExpr(sbOut->tyenv, data)),
+                              shadow_of(&env, data));
             }
             addStmtToIRSB(sbOut, st);
             break;
             
 
         case Ist_PutI:
-            if(trace){
-              VG_(printf)("Ist_PutI\n");
+            {
+              IRPutI* puti = st->Ist.PutI.details;
+              emit_put_shadow_i(&env, puti->descr, puti->ix, puti->bias,
+                                shadow_of(&env, puti->data));
             }
             addStmtToIRSB(sbOut, st);
             break;
         case Ist_WrTmp:
-            // writes a value to a temp variable
-            if(trace){
+            // writes a value to a temp variable, the shadow temp gets the
+            // union of the shadows of everything the value is computed from
+            {
               //VG_(printf)("Ist_WrTmp\n");
               IRTemp wrtmp = st->Ist.WrTmp.tmp;
               IRExpr* data = st->Ist.WrTmp.data;
+
+              // provably clean or never used, skip it
+              if(!temp_info(wrtmp)->needs_shadow){
+                if(data->tag == Iex_Get){
+                  n_helpers_elided++;
+                }
+                else if(data->tag == Iex_Load){
+                  n_shadow_loads_elided++;
+                }
+                else if(data->tag == Iex_Binop
+                        && shadow_of(&env, data->Iex.Binop.arg1) != NULL
+                        && shadow_of(&env, data->Iex.Binop.arg2) != NULL){
+                  n_helpers_elided++;
+                }
+                set_shadow_of(&env, wrtmp, NULL);
+                addStmtToIRSB(sbOut, st);
+                break;
+              }
+
               // handle different types of IR expressions
               switch(data->tag){
                 case Iex_Get:
                 {
-                  // guest registers must be 16 bits or 32 bits
-                  // IRType ty = data->Iex.Get.ty;
-                  // tl_assert(ty == Ity_I32 || ty == Ity_I16);
-                  
-                  
-                  Int offset = data->Iex.Get.offset;
-                  //VG_(printf)("data = %lx, type = %x, offet = %x\n", (SizeT)data, data->Iex.Get.ty, offset);
-
-                  IRExpr** argv = mkIRExprVec_2(mkIRExpr_HWord((HWord)offset),
-                    mkIRExpr_HWord((HWord)wrtmp));
-
-                  dirty = unsafeIRDirty_0_N(2, "dd_get_reg", VG_(fnptr_to_fnentry)(dd_get_reg), argv);
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+                  set_shadow_of(&env, wrtmp, emit_get_shadow(&env, data->Iex.Get.offset,
+                                                            sizeofIRType(data->Iex.Get.ty)));
                   break;
-
                 }
                 case Iex_GetI:
                 {
+                  set_shadow_of(&env, wrtmp, emit_get_shadow_i(&env, data->Iex.GetI.descr,
+                                                              data->Iex.GetI.ix,
+                                                              data->Iex.GetI.bias));
                   break;
                 }
                 case Iex_RdTmp:
                 {
                   //VG_(printf)("Temp to temp assignment\n");
-                  IRTemp rdtmp = data->Iex.RdTmp.tmp;
-                  IRExpr** argv = mkIRExprVec_2(mkIRExpr_HWord((HWord)rdtmp), mkIRExpr_HWord((HWord)wrtmp));
-                  dirty = unsafeIRDirty_0_N(2, "dd_tmp_to_tmp", VG_(fnptr_to_fnentry)(dd_tmp_to_tmp), argv);
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+                  TempInfo* src = temp_info(data->Iex.RdTmp.tmp);
+                  set_shadow_of(&env, wrtmp, shadow_of(&env, data));
+                  temp_info(wrtmp)->load_addr = src->load_addr;
+                  temp_info(wrtmp)->load_epoch = src->load_epoch;
                   break;
                 }
                 case Iex_Qop:
                 {
-                  //VG_(printf)("Q operation\n");
-                  IRExpr* arg1 = data->Iex.Qop.details->arg1;
-                  IRExpr* arg2 = data->Iex.Qop.details->arg2;
-                  IRExpr* arg3 = data->Iex.Qop.details->arg3;
-                  IRExpr* arg4 = data->Iex.Qop.details->arg4;
-
-                  IRTemp tmp1, tmp2, tmp3, tmp4;
-
-                  tmp1 = (arg1!=NULL)? arg1->Iex.RdTmp.tmp: -1;
-                  tmp2 = (arg2!=NULL)? arg2->Iex.RdTmp.tmp: -1;
-                  tmp3 = (arg3!=NULL)? arg3->Iex.RdTmp.tmp: -1;
-                  tmp4 = (arg4!=NULL)? arg4->Iex.RdTmp.tmp: -1;
-
-
-
-                  IRExpr** argv = mkIRExprVec_5(
-                    mkIRExpr_HWord((HWord)tmp1),
-                    mkIRExpr_HWord((HWord)tmp2),
-                    mkIRExpr_HWord((HWord)tmp3),
-                    mkIRExpr_HWord((HWord)tmp4),
-                    mkIRExpr_HWord((HWord)wrtmp));
-
-                  dirty = unsafeIRDirty_0_N(3, "dd_qop_to_tmp", VG_(fnptr_to_fnentry)(dd_qop_to_tmp), argv);
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+                  IRQop* qop = data->Iex.Qop.details;
+                  IRExpr* shadow = emit_union(&env, shadow_of(&env, qop->arg1), shadow_of(&env, qop->arg2));
+                  shadow = emit_union(&env, shadow, shadow_of(&env, qop->arg3));
+                  shadow = emit_union(&env, shadow, shadow_of(&env, qop->arg4));
+                  set_shadow_of(&env, wrtmp, shadow);
                   break;
-
-
                 }
                 case Iex_Triop:
                 {
-                  //VG_(printf)("Tri operation\n");
-
-                  IRExpr* arg1 = data->Iex.Triop.details->arg1;
-                  IRExpr* arg2 = data->Iex.Triop.details->arg2;
-                  IRExpr* arg3 = data->Iex.Triop.details->arg3;
-
-                  IRTemp tmp1, tmp2, tmp3;
-
-                  tmp1 = (arg1!=NULL)? arg1->Iex.RdTmp.tmp: -1;
-                  tmp2 = (arg2!=NULL)? arg2->Iex.RdTmp.tmp: -1;
-                  tmp3 = (arg3!=NULL)? arg3->Iex.RdTmp.tmp: -1;
-
-
-
-                  IRExpr** argv = mkIRExprVec_4(
-                    mkIRExpr_HWord((HWord)tmp1),
-                    mkIRExpr_HWord((HWord)tmp2),
-                    mkIRExpr_HWord((HWord)tmp3),
-                    mkIRExpr_HWord((HWord)wrtmp));
-
-                  dirty = unsafeIRDirty_0_N(3, "dd_triop_to_tmp", VG_(fnptr_to_fnentry)(dd_triop_to_tmp), argv);
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+                  IRTriop* triop = data->Iex.Triop.details;
+                  IRExpr* shadow = emit_union(&env, shadow_of(&env, triop->arg1), shadow_of(&env, triop->arg2));
+                  shadow = emit_union(&env, shadow, shadow_of(&env, triop->arg3));
+                  set_shadow_of(&env, wrtmp, shadow);
                   break;
-
                 }
                 case Iex_Binop:
                 {
-                  //VG_(printf)("Binary operation\n");
-                  IRExpr* arg1 = data->Iex.Binop.arg1;
-                  IRExpr* arg2 = data->Iex.Binop.arg2;
-
-
-                  IRTemp tmp1, tmp2;
-
-                  tmp1 = (arg1->tag == Iex_RdTmp)? arg1->Iex.RdTmp.tmp: -1;
-                  tmp2 = (arg2->tag == Iex_RdTmp)? arg2->Iex.RdTmp.tmp: -1;
-
-                  IRExpr** argv = mkIRExprVec_3(
-                    mkIRExpr_HWord((HWord)tmp1),
-                    mkIRExpr_HWord((HWord)tmp2),
-                    mkIRExpr_HWord((HWord)wrtmp));
-
-                  dirty = unsafeIRDirty_0_N(3, "dd_binop_to_tmp", VG_(fnptr_to_fnentry)(dd_binop_to_tmp), argv);
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
-
+                  set_shadow_of(&env, wrtmp, emit_union(&env, shadow_of(&env, data->Iex.Binop.arg1),
+                                                        shadow_of(&env, data->Iex.Binop.arg2)));
                   break;
                 }
                 case Iex_Unop:
                 {
-                  //VG_(printf)("Unary operation\n");
-                  //TODO:
-                  IRExpr* arg1 = data->Iex.Unop.arg;
-
-                  IRTemp tmp1;
-                  tmp1 = (arg1->tag == Iex_RdTmp)? arg1->Iex.RdTmp.tmp: -1;
-
-                  IRExpr** argv = mkIRExprVec_2(mkIRExpr_HWord((HWord)tmp1), mkIRExpr_HWord((HWord)wrtmp));
-                  dirty = unsafeIRDirty_0_N(2, "dd_unop_to_tmp", VG_(fnptr_to_fnentry)(dd_unop_to_tmp), argv);
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
-
+                  set_shadow_of(&env, wrtmp, shadow_of(&env, data->Iex.Unop.arg));
+                  break;
+                }
+                case Iex_ITE:
+                {
+                  // select the shadow of the value that was selected
+                  IRExpr* shadow_t = shadow_of(&env, data->Iex.ITE.iftrue);
+                  IRExpr* shadow_f = shadow_of(&env, data->Iex.ITE.iffalse);
+                  if(shadow_t == NULL && shadow_f == NULL){
+                    set_shadow_of(&env, wrtmp, NULL);
+                  }
+                  else{
+                    set_shadow_of(&env, wrtmp, IRExpr_ITE(data->Iex.ITE.cond,
+                                  (shadow_t == NULL)? mk_id(EMPTY_SET) : shadow_t,
+                                  (shadow_f == NULL)? mk_id(EMPTY_SET) : shadow_f));
+                  }
                   break;
                 }
                 case Iex_Load:
                 {
-
-                  IRExpr* addr = data->Iex.Load.addr;
-                  IRType ty = data->Iex.Load.ty;
-
-
-                  IRExpr** argv = mkIRExprVec_2(addr, mkIRExpr_HWord((HWord)wrtmp));
-                  dirty = unsafeIRDirty_0_N(2, "dd_load_from_addr", 
-                    VG_(fnptr_to_fnentry)(dd_load_from_addr), argv);
-
-                  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
-
-
+                  // the shadow is read straight out of the shadow map
+                  set_shadow_of(&env, wrtmp, emit_load_shadow(&env, data->Iex.Load.addr,
+                                                             sizeofIRType(data->Iex.Load.ty),
+                                                             NULL));
+                  temp_info(wrtmp)->load_addr = data->Iex.Load.addr;
+                  temp_info(wrtmp)->load_epoch = env.mem_epoch;
                   break;
                 }
-                case Iex_Const:
-                case Iex_ITE:
                 case Iex_CCall:
+                {
+                  // a clean helper, such as the condition code ones,
+                  // depends on all its arguments
+                  IRExpr* shadow = NULL;
+                  for(Int j = 0; data->Iex.CCall.args[j] != NULL; j++){
+                    shadow = emit_union(&env, shadow, shadow_of(&env, data->Iex.CCall.args[j]));
+                  }
+                  set_shadow_of(&env, wrtmp, shadow);
+                  break;
+                }
+                case Iex_Const:
                 case Iex_VECRET:
                 case Iex_BBPTR:
-                default: break;
+                default:
+                  set_shadow_of(&env, wrtmp, NULL);
+                  break;
               }
             }
             addStmtToIRSB(sbOut, st);
             break;
         case Ist_Store:
-            if(trace){
+            {
               //VG_(printf)("Ist_Store\n");
               IRExpr* addr = st->Ist.Store.addr;
               IRExpr* data = st->Ist.Store.data;
-
-
-              // we handle temp, temp case
-              //IRTemp addr_temp = (addr->tag == Iex_RdTmp)? addr->Iex.RdTmp.tmp : -1;
-              IRTemp data_temp = (data->tag == Iex_RdTmp)? data->Iex.RdTmp.tmp : -1;
-
-              IRExpr** argv = mkIRExprVec_2(addr, mkIRExpr_HWord((HWord)data_temp));
-              dirty = unsafeIRDirty_0_N(2, "dd_store_tmp_to_addr",VG_(fnptr_to_fnentry)(dd_store_tmp_to_addr), argv);
-
-              addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
-
+              IRExpr* shadow = shadow_of(&env, data);
+              Int size = sizeofIRType(typeOfIRExpr(sbOut->tyenv, data));
+
+              // storing a constant or an untainted temp changes nothing, so
+              // the helper only runs when the data carries a set
+              if(shadow != NULL && !env.replaced){
+                IRExpr* src = loaded_from(&env, data, size);
+                if(src != NULL){
+                  emit_store_copy(&env, addr, src, size, shadow);
+                }
+                else{
+                  emit_store_shadow(&env, addr, size, shadow, NULL);
+                }
+              }
+              env.mem_epoch++;
 
             }
             addStmtToIRSB(sbOut, st);
             break;
         case Ist_LoadG:
-            if(trace){
-              VG_(printf)("Ist_LoadG\n");
+            // dst = guard ? load(addr) : alt
+            {
+              IRLoadG* lg = st->Ist.LoadG.details;
+              IRType res_ty, arg_ty;
+              typeOfIRLoadGOp(lg->cvt, &res_ty, &arg_ty);
+
+              if(temp_info(lg->dst)->needs_shadow && !env.replaced){
+                IRExpr* mem = emit_load_shadow(&env, lg->addr, sizeofIRType(arg_ty), lg->guard);
+                IRExpr* alt = shadow_of(&env, lg->alt);
+                set_shadow_of(&env, lg->dst, IRExpr_ITE(lg->guard, mem,
+                                                      (alt == NULL)? mk_id(EMPTY_SET) : alt));
+              }
+              else{
+                set_shadow_of(&env, lg->dst, NULL);
+              }
             }
             addStmtToIRSB(sbOut, st);
             break;
         case Ist_StoreG:
-            if(trace){
-              VG_(printf)("Ist_StoreG\n");
+            {
+              IRStoreG* sg = st->Ist.StoreG.details;
+              IRExpr* shadow = shadow_of(&env, sg->data);
+              if(shadow != NULL && !env.replaced){
+                emit_store_shadow(&env, sg->addr, sizeofIRType(typeOfIRExpr(sbOut->tyenv, sg->data)),
+                                  shadow, sg->guard);
+              }
+              env.mem_epoch++;
             }
             addStmtToIRSB(sbOut, st);
             break;
         case Ist_CAS:
-            if(trace){
-              VG_(printf)("Ist_CAS\n");
+            // a load of the old value, and a store of the new one if the
+            // old one was the expected one. the store is instrumented
+            // after the CAS, once the old value is known
+            {
+              IRCAS* cas = st->Ist.CAS.details;
+              Int size = sizeofIRType(typeOfIRExpr(sbOut->tyenv, cas->dataLo));
+              IRExpr* addr_hi = NULL;
+              Bool shadowed = !env.replaced;
+
+              if(cas->oldHi != IRTemp_INVALID){
+                addr_hi = word_add(&env, cas->addr, mkIRExpr_HWord(size));
+              }
+              set_shadow_of(&env, cas->oldLo,
+                            (shadowed && temp_info(cas->oldLo)->needs_shadow)?
+                            emit_load_shadow(&env, cas->addr, size, NULL) : NULL);
+              if(addr_hi != NULL){
+                set_shadow_of(&env, cas->oldHi,
+                              (shadowed && temp_info(cas->oldHi)->needs_shadow)?
+                              emit_load_shadow(&env, addr_hi, size, NULL) : NULL);
+              }
+              addStmtToIRSB(sbOut, st);
+
+              IRExpr* shadow_lo = shadow_of(&env, cas->dataLo);
+              IRExpr* shadow_hi = shadow_of(&env, cas->dataHi);
+              if(shadowed && (shadow_lo != NULL || shadow_hi != NULL)){
+                IRExpr* done = emit_cas_eq(&env, cas->oldLo, cas->expdLo);
+                if(addr_hi != NULL){
+                  done = emit_cond(&env, Iop_And32, done,
+                                   emit_cas_eq(&env, cas->oldHi, cas->expdHi));
+                }
+                if(shadow_lo != NULL){
+                  emit_store_shadow(&env, cas->addr, size, shadow_lo, done);
+                }
+                if(shadow_hi != NULL){
+                  emit_store_shadow(&env, addr_hi, size, shadow_hi, done);
+                }
+              }
+              env.mem_epoch++;
             }
-            addStmtToIRSB(sbOut, st);
             break;
         case Ist_LLSC:
-            if(trace){
-              VG_(printf)("Ist_LLSC\n");
+            // load linked is a load. store conditional is a store that
+            // happened if its result is true
+            {
+              IRTemp res = st->Ist.LLSC.result;
+              IRExpr* addr = st->Ist.LLSC.addr;
+              IRExpr* storedata = st->Ist.LLSC.storedata;
+
+              if(storedata == NULL){
+                set_shadow_of(&env, res,
+                              (temp_info(res)->needs_shadow && !env.replaced)?
+                              emit_load_shadow(&env, addr,
+                                               sizeofIRType(typeOfIRTemp(sbOut->tyenv, res)),
+                                               NULL) : NULL);
+                addStmtToIRSB(sbOut, st);
+              }
+              else{
+                IRExpr* shadow = shadow_of(&env, storedata);
+                addStmtToIRSB(sbOut, st);
+                set_shadow_of(&env, res, NULL);
+                if(shadow != NULL && !env.replaced){
+                  emit_store_shadow(&env, addr,
+                                    sizeofIRType(typeOfIRExpr(sbOut->tyenv, storedata)),
+                                    shadow, IRExpr_RdTmp(res));
+                }
+                env.mem_epoch++;
+              }
             }
-            addStmtToIRSB(sbOut, st);
             break;
         case Ist_Dirty:
-            if(trace){
-              VG_(printf)("Ist_Dirty\n");
+            if(!env.replaced){
+              instrument_dirty(&env, st->Ist.Dirty.details);
             }
             addStmtToIRSB(sbOut, st);
             break;
         case Ist_MBE:
-            if(trace){
-              VG_(printf)("Ist_MBE\n");
-            }
-            addStmtToIRSB(sbOut, st);
-            break;
         case Ist_Exit:
-            if(trace){
-              //VG_(printf)("Ist_Exit\n");
-            }
             addStmtToIRSB(sbOut, st);
             break;
 
@@ -722,22 +4325,34 @@ IRSB* dd_instrument ( VgCallbackClosure* closure,
 
 static void dd_fini(Int exitcode)
 {
-  // free memory
-  VG_(free)(tempshadow);
-  for(ULong i=0; i<0xFFFF; i++){
-    if(table[i]!=NULL){
-
-      for(ULong j=0; j<0xFFFF; j++){
-        if(table[i][j].head!=NULL){
-          //VG_(printf)("head at %lx is not null\n", j);
-          free_addr_list(&table[i][j]);
-        }
-      }
-      VG_(free)(table[i]);
+  if(log_fd >= 0){
+    close_log();
+  }
 
-    }
+  // bool mode reports no stores, so this is its result
+  if(bool_mode){
+    VG_(umsg)("dd: %llu tainted %s at exit\n", count_bits(),
+              (gran_shift == 0)? "bytes" : "cells");
+  }
+
+  if(clo_stats || VG_(clo_stats) || VG_(clo_verbosity) > 1){
+    print_stats();
   }
-  VG_(free)(table);
+  if(clo_profile > 0){
+    print_profile();
+  }
+
+  // free memory
+  free_shadow_mem();
+  free_sets();
+  free_profile();
+  free_globs(&trace_fns);
+  free_globs(&skip_fns);
+  free_globs(&skip_objs);
+  free_sources();
+  VG_(HT_destruct)(heap_blocks, VG_(free));
+  VG_(free)(shadow_regs_buf);
+  VG_(free)(temps);
 
 }
 
@@ -757,24 +4372,43 @@ static void dd_pre_clo_init(void)
                                  dd_fini);
 
    //sys calls
+   VG_(needs_command_line_options)(dd_process_cmd_line_option,
+                                   dd_print_usage,
+                                   dd_print_debug_usage);
+
    VG_(needs_syscall_wrapper)(dd_pre_call, dd_post_call);
 
-   // We assume 32 bit programs
-   // this is used for memory
-   table = (AddrList**)VG_(malloc)("Memory shadow", 0xFFFF*sizeof(AddrList*));
-   
-   //initialize to NULL
-   for(ULong i = 0; i < 0xFFFF; i++){
-     table[i] = NULL;
-   }
+   // shadow copies for memcpy and friends
+   VG_(needs_client_requests)(dd_handle_client_request);
+
+   VG_(track_start_client_code)(dd_start_client_code);
+   VG_(track_pre_deliver_signal)(dd_pre_deliver_signal);
+   VG_(track_post_deliver_signal)(dd_post_deliver_signal);
+
+   // shadow of dead memory is cleared and freed
+   VG_(needs_malloc_replacement)(dd_malloc,
+                                 dd_malloc,
+                                 dd_malloc,
+                                 dd_memalign,
+                                 dd_calloc,
+                                 dd_free,
+                                 dd_free,
+                                 dd_free,
+                                 dd_realloc,
+                                 dd_malloc_usable_size,
+                                 0);
+   heap_blocks = VG_(HT_construct)("dd.heap_blocks");
+
+   VG_(track_new_mem_stack)(dd_clear_mem);
+   VG_(track_die_mem_stack)(dd_clear_mem);
+   VG_(track_die_mem_munmap)(dd_clear_mem);
+   VG_(track_die_mem_brk)(dd_clear_mem);
 
-   // this is used for temporary variables
-   tempshadow = (AddrList*)VG_(malloc)("Temp shadow", 0xFFFF*sizeof(AddrList));
+   // this is used for memory
+   init_shadow_mem();
 
-   // set head to NULL
-   for(ULong i = 0; i < 0xFFFF; i++){
-    tempshadow[i].head = NULL;
-   }
+   // interned provenance sets
+   init_sets();
 
 }
 
@@ -0,0 +1,266 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Replacements for memcpy() et al.          dd_replace_strmem.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of ddtector, the dynamic data dependance detector.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+   These run on the simulated CPU in place of the libc functions. The
+   tool does not instrument code of this object (see is_replacement in
+   dd_main.c), instead each call moves the shadow of the whole buffer
+   with one client request. This is built into
+   vgpreload_ddtector-<platform>.so like the preload objects of the
+   other tools, so with -fno-builtin and
+   -fno-tree-loop-distribute-patterns to keep the compiler from turning
+   the loops back into calls to memcpy or memset.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_redir.h"
+#include "ddtector.h"
+
+static __inline__ __attribute__((always_inline))
+void dd_copy_bytes ( void* dst, const void* src, SizeT len )
+{
+   UChar*       d = (UChar*)dst;
+   const UChar* s = (const UChar*)src;
+
+   if (d == s || len == 0)
+      return;
+
+   if (d < s || d >= s + len) {
+      if ((((Addr)d | (Addr)s) & (sizeof(UWord)-1)) == 0) {
+         for (; len >= sizeof(UWord); len -= sizeof(UWord)) {
+            *(UWord*)d = *(const UWord*)s;
+            d += sizeof(UWord);
+            s += sizeof(UWord);
+         }
+      }
+      while (len-- > 0)
+         *d++ = *s++;
+   } else {
+      /* overlapping, copy from the end */
+      d += len;
+      s += len;
+      while (len-- > 0)
+         *--d = *--s;
+   }
+}
+
+static __inline__ __attribute__((always_inline))
+void dd_set_bytes ( void* dst, Int c, SizeT len )
+{
+   UChar* d = (UChar*)dst;
+   UWord  w = (UChar)c;
+
+   w |= w << 8;
+   w |= w << 16;
+   if (sizeof(UWord) == 8)
+      w |= (w << 16) << 16;
+
+   while (len > 0 && ((Addr)d & (sizeof(UWord)-1)) != 0) {
+      *d++ = (UChar)c;
+      len--;
+   }
+   for (; len >= sizeof(UWord); len -= sizeof(UWord)) {
+      *(UWord*)d = w;
+      d += sizeof(UWord);
+   }
+   while (len-- > 0)
+      *d++ = (UChar)c;
+}
+
+/* as in memcheck, so the _chk functions still stop the program the way
+   glibc would */
+static __inline__ void my_exit ( int x )
+{
+   extern __attribute__ ((__noreturn__)) void _exit(int status);
+   _exit(x);
+}
+
+static __inline__ __attribute__((always_inline))
+SizeT dd_strlen ( const HChar* s )
+{
+   SizeT n = 0;
+   while (s[n])
+      n++;
+   return n;
+}
+
+
+/*---------------------- memcpy, memmove ----------------------*/
+
+/* memcpy is treated as memmove, an overlapping memcpy is undefined
+   anyway */
+#define MEMMOVE(soname, fnname) \
+   void* VG_REPLACE_FUNCTION_EZU(20180,soname,fnname) \
+            ( void* dst, const void* src, SizeT len ); \
+   void* VG_REPLACE_FUNCTION_EZU(20180,soname,fnname) \
+            ( void* dst, const void* src, SizeT len ) \
+   { \
+      dd_copy_bytes(dst, src, len); \
+      _DD_COPY_RANGE(dst, src, len); \
+      return dst; \
+   }
+
+#define MEMCPY_CHK(soname, fnname) \
+   void* VG_REPLACE_FUNCTION_EZU(20300,soname,fnname) \
+            ( void* dst, const void* src, SizeT len, SizeT dstlen ); \
+   void* VG_REPLACE_FUNCTION_EZU(20300,soname,fnname) \
+            ( void* dst, const void* src, SizeT len, SizeT dstlen ) \
+   { \
+      if (dstlen < len) { \
+         VALGRIND_PRINTF_BACKTRACE( \
+            "*** " #fnname ": buffer overflow detected ***: " \
+            "program terminated\n"); \
+         my_exit(1); \
+      } \
+      dd_copy_bytes(dst, src, len); \
+      _DD_COPY_RANGE(dst, src, len); \
+      return dst; \
+   }
+
+#define MEMPCPY(soname, fnname) \
+   void* VG_REPLACE_FUNCTION_EZU(20400,soname,fnname) \
+            ( void* dst, const void* src, SizeT len ); \
+   void* VG_REPLACE_FUNCTION_EZU(20400,soname,fnname) \
+            ( void* dst, const void* src, SizeT len ) \
+   { \
+      dd_copy_bytes(dst, src, len); \
+      _DD_COPY_RANGE(dst, src, len); \
+      return (UChar*)dst + len; \
+   }
+
+#if defined(VGO_linux)
+ MEMMOVE(VG_Z_LIBC_SONAME, memcpy)
+ MEMMOVE(VG_Z_LIBC_SONAME, memcpyZAGLIBCZu2Zd2Zd5) /* memcpy@GLIBC_2.2.5 */
+ MEMMOVE(VG_Z_LIBC_SONAME, memcpyZAGLIBCZu2Zd14)   /* memcpy@GLIBC_2.14 */
+ MEMMOVE(VG_Z_LIBC_SONAME, __GI_memcpy)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memcpy_sse2)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memcpy_sse2_unaligned)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memcpy_ssse3)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memcpy_avx_unaligned)
+ MEMMOVE(VG_Z_LIBC_SONAME, memmove)
+ MEMMOVE(VG_Z_LIBC_SONAME, __GI_memmove)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memmove_sse2)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memmove_ssse3)
+ MEMMOVE(VG_Z_LIBC_SONAME, __memmove_avx_unaligned)
+ MEMCPY_CHK(VG_Z_LIBC_SONAME, __memcpy_chk)
+ MEMCPY_CHK(VG_Z_LIBC_SONAME, __memmove_chk)
+ MEMPCPY(VG_Z_LIBC_SONAME, mempcpy)
+ MEMPCPY(VG_Z_LIBC_SONAME, __GI_mempcpy)
+#endif
+
+
+/*---------------------- memset ----------------------*/
+
+/* the filled bytes are made untainted. the fill byte may come from
+   input, but its taint is in the registers of the caller, which these
+   functions do not see, so it is lost */
+#define MEMSET(soname, fnname) \
+   void* VG_REPLACE_FUNCTION_EZU(20210,soname,fnname) \
+            ( void* dst, Int c, SizeT len ); \
+   void* VG_REPLACE_FUNCTION_EZU(20210,soname,fnname) \
+            ( void* dst, Int c, SizeT len ) \
+   { \
+      dd_set_bytes(dst, c, len); \
+      _DD_CLEAR_RANGE(dst, len); \
+      return dst; \
+   }
+
+#define BZERO(soname, fnname) \
+   void VG_REPLACE_FUNCTION_EZU(20220,soname,fnname) \
+            ( void* dst, SizeT len ); \
+   void VG_REPLACE_FUNCTION_EZU(20220,soname,fnname) \
+            ( void* dst, SizeT len ) \
+   { \
+      dd_set_bytes(dst, 0, len); \
+      _DD_CLEAR_RANGE(dst, len); \
+   }
+
+#if defined(VGO_linux)
+ MEMSET(VG_Z_LIBC_SONAME, memset)
+ MEMSET(VG_Z_LIBC_SONAME, __GI_memset)
+ MEMSET(VG_Z_LIBC_SONAME, __memset_sse2)
+ MEMSET(VG_Z_LIBC_SONAME, __memset_avx2)
+ BZERO(VG_Z_LIBC_SONAME, bzero)
+ BZERO(VG_Z_LIBC_SONAME, __bzero)
+#endif
+
+
+/*---------------------- strcpy, stpcpy, strncpy ----------------------*/
+
+#define STRCPY(soname, fnname) \
+   HChar* VG_REPLACE_FUNCTION_EZU(20080,soname,fnname) \
+            ( HChar* dst, const HChar* src ); \
+   HChar* VG_REPLACE_FUNCTION_EZU(20080,soname,fnname) \
+            ( HChar* dst, const HChar* src ) \
+   { \
+      SizeT len = dd_strlen(src) + 1; \
+      dd_copy_bytes(dst, src, len); \
+      _DD_COPY_RANGE(dst, src, len); \
+      return dst; \
+   }
+
+#define STPCPY(soname, fnname) \
+   HChar* VG_REPLACE_FUNCTION_EZU(20200,soname,fnname) \
+            ( HChar* dst, const HChar* src ); \
+   HChar* VG_REPLACE_FUNCTION_EZU(20200,soname,fnname) \
+            ( HChar* dst, const HChar* src ) \
+   { \
+      SizeT len = dd_strlen(src) + 1; \
+      dd_copy_bytes(dst, src, len); \
+      _DD_COPY_RANGE(dst, src, len); \
+      return dst + len - 1; \
+   }
+
+/* the padding after the string is untainted */
+#define STRNCPY(soname, fnname) \
+   HChar* VG_REPLACE_FUNCTION_EZU(20090,soname,fnname) \
+            ( HChar* dst, const HChar* src, SizeT n ); \
+   HChar* VG_REPLACE_FUNCTION_EZU(20090,soname,fnname) \
+            ( HChar* dst, const HChar* src, SizeT n ) \
+   { \
+      SizeT len = 0; \
+      while (len < n && src[len]) \
+         len++; \
+      dd_copy_bytes(dst, src, len); \
+      _DD_COPY_RANGE(dst, src, len); \
+      dd_set_bytes(dst + len, 0, n - len); \
+      _DD_CLEAR_RANGE(dst + len, n - len); \
+      return dst; \
+   }
+
+#if defined(VGO_linux)
+ STRCPY(VG_Z_LIBC_SONAME, strcpy)
+ STRCPY(VG_Z_LIBC_SONAME, __GI_strcpy)
+ STRCPY(VG_Z_LIBC_SONAME, __strcpy_sse2)
+ STRCPY(VG_Z_LIBC_SONAME, __strcpy_sse2_unaligned)
+ STPCPY(VG_Z_LIBC_SONAME, stpcpy)
+ STPCPY(VG_Z_LIBC_SONAME, __GI_stpcpy)
+ STPCPY(VG_Z_LIBC_SONAME, __stpcpy_sse2)
+ STPCPY(VG_Z_LIBC_SONAME, __stpcpy_sse2_unaligned)
+ STRNCPY(VG_Z_LIBC_SONAME, strncpy)
+ STRNCPY(VG_Z_LIBC_SONAME, __GI_strncpy)
+ STRNCPY(VG_Z_LIBC_SONAME, __strncpy_sse2)
+ STRNCPY(VG_Z_LIBC_SONAME, __strncpy_sse2_unaligned)
+#endif
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
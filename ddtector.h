@@ -0,0 +1,83 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Client requests for ddtector.                    ddtector.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of ddtector, the dynamic data dependance detector.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __DDTECTOR_H
+#define __DDTECTOR_H
+
+#include "valgrind.h"
+
+typedef
+   enum {
+      VG_USERREQ__DD_START = VG_USERREQ_TOOL_BASE('D','D'),
+      VG_USERREQ__DD_STOP,
+      VG_USERREQ__DD_QUERY,
+      VG_USERREQ__DD_CLEAR,
+
+      /* These are used by the function replacements in
+         dd_replace_strmem.c, not by client code. */
+      _VG_USERREQ__DD_COPY_RANGE = VG_USERREQ_TOOL_BASE('D','D') + 256,
+      _VG_USERREQ__DD_CLEAR_RANGE
+   } Vg_DDClientRequest;
+
+/* Start and stop tracing. Input read while tracing is stopped is not
+   labelled, and leaves the bytes it overwrote untainted. With
+   --dd-trace=client only these switch tracing, and stores are only
+   reported between them; otherwise tracing also starts at main and
+   stops at exit. */
+#define VALGRIND_DD_START                                             \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__DD_START, 0, 0, 0, 0, 0)
+
+#define VALGRIND_DD_STOP                                              \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__DD_STOP, 0, 0, 0, 0, 0)
+
+/* Report the provenance of [_qzz_addr, _qzz_addr+_qzz_len) in the
+   same [DD] format as stores, one line per run of bytes with the same
+   labels. With --dd-output=queries this is the only provenance
+   reported. Returns the number of tainted bytes (cells with
+   --dd-granularity), 0 when not running under ddtector. */
+#define VALGRIND_DD_QUERY(_qzz_addr, _qzz_len)                        \
+   (unsigned long)VALGRIND_DO_CLIENT_REQUEST_EXPR(0,                  \
+                            VG_USERREQ__DD_QUERY,                     \
+                            (_qzz_addr), (_qzz_len), 0, 0, 0)
+
+/* Make [_qzz_addr, _qzz_addr+_qzz_len) untainted, whether or not
+   tracing is on. */
+#define VALGRIND_DD_CLEAR(_qzz_addr, _qzz_len)                        \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__DD_CLEAR,              \
+                                   (_qzz_addr), (_qzz_len), 0, 0, 0)
+
+/* Give [_qzz_dst, _qzz_dst+_qzz_len) the taint of [_qzz_src, ...),
+   the ranges may overlap. */
+#define _DD_COPY_RANGE(_qzz_dst, _qzz_src, _qzz_len)                 \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(_VG_USERREQ__DD_COPY_RANGE,      \
+                                   (_qzz_dst), (_qzz_src), (_qzz_len), \
+                                   0, 0)
+
+/* Make [_qzz_addr, _qzz_addr+_qzz_len) untainted. */
+#define _DD_CLEAR_RANGE(_qzz_addr, _qzz_len)                         \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(_VG_USERREQ__DD_CLEAR_RANGE,     \
+                                   (_qzz_addr), (_qzz_len), 0, 0, 0)
+
+#endif
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
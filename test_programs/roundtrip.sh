@@ -0,0 +1,89 @@
+#!/bin/bash
+# Checks that a binary log decodes to the text ddtector prints. Every
+# case below is run twice under ddtector on the same input, once
+# printing [DD] lines and once with --dd-log-file, and the [DD] lines
+# of the first run are diffed against dd_decode of the log. The cases
+# cover label ranges (--dd-max-labels), set ids that are dropped and
+# defined again (bn_hash), queries and bool mode. tc4 is also checked
+# for stores reported twice. usage, from anywhere:
+#
+#   test_programs/roundtrip.sh [ddtector options...]
+#
+# and the environment may set
+#
+#   VALGRIND  the valgrind to run [valgrind]
+#   CFLAGS    flags the programs are built with, they need the
+#             directory holding valgrind.h [-O2 -I/usr/include/valgrind]
+#   INPUT     file the programs read [bench/bn_hash.c]
+#
+# prints one line per case and exits non zero if any differs.
+
+TESTS=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$TESTS")
+VALGRIND=${VALGRIND:-valgrind}
+CFLAGS=${CFLAGS:-"-O2 -I/usr/include/valgrind"}
+INPUT=${INPUT:-$ROOT/bench/bn_hash.c}
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+${CC:-cc} -O2 -o "$TMP/dd_decode" "$ROOT/dd_decode.c" || exit 1
+for p in tc1 tc2 tc3 tc4 tc5; do
+  ${CC:-cc} $CFLAGS -g -I"$ROOT" -o "$TMP/$p" "$TESTS/$p.c" || exit 1
+done
+${CC:-cc} -O2 -g -o "$TMP/bn_hash" "$ROOT/bench/bn_hash.c" || exit 1
+
+failed=0
+
+# check <program> <ddtector options...>
+check(){
+  local prog=$1
+  shift
+  "$VALGRIND" --tool=ddtector "$@" "${EXTRA[@]}" "$TMP/$prog" "$INPUT" \
+      < "$INPUT" > "$TMP/out" 2>&1
+  grep -F '[DD]' "$TMP/out" > "$TMP/text"
+  "$VALGRIND" --tool=ddtector --dd-log-file="$TMP/log" "$@" "${EXTRA[@]}" \
+      "$TMP/$prog" "$INPUT" < "$INPUT" > /dev/null 2>&1
+  "$TMP/dd_decode" "$TMP/log" > "$TMP/decoded" || { failed=1; return; }
+  if cmp -s "$TMP/text" "$TMP/decoded"; then
+    printf "ok    %-8s %s (%d lines)\n" "$prog" "$*" "$(wc -l < "$TMP/text")"
+  else
+    printf "FAIL  %-8s %s\n" "$prog" "$*"
+    diff "$TMP/text" "$TMP/decoded" | head -n 10
+    failed=1
+  fi
+}
+
+# unique <program> <ddtector options...>: the stores the program reports
+# when run with an argument of "stores" must all be to different
+# addresses, as they are for tc4. a memcpy that is both instrumented and
+# moved by its client request reports every byte twice
+unique(){
+  local prog=$1
+  shift
+  "$VALGRIND" --tool=ddtector "$@" "${EXTRA[@]}" "$TMP/$prog" "$INPUT" stores \
+      < "$INPUT" > "$TMP/out" 2>&1
+  grep -F '[DD]' "$TMP/out" | grep -v '\[DD\]: source' | cut -d' ' -f1 | sort | uniq -d > "$TMP/dups"
+  if [ -s "$TMP/dups" ]; then
+    printf "FAIL  %-8s %s: stores reported twice\n" "$prog" "$*"
+    head -n 10 "$TMP/dups"
+    failed=1
+  else
+    printf "ok    %-8s %s (no duplicate stores)\n" "$prog" "$*"
+  fi
+}
+
+EXTRA=("$@")
+check tc1
+check tc2
+check tc3
+check tc2 --dd-max-labels=2
+check tc4 --dd-trace=client --dd-output=queries
+check tc4 --dd-trace=client --dd-output=queries --dd-granularity=8
+unique tc4 --dd-trace=client
+check tc5 --dd-mode=bool
+check bn_hash
+check bn_hash --dd-max-labels=4
+check bn_hash --dd-granularity=8 --dd-max-labels=4
+
+exit $failed
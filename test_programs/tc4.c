@@ -0,0 +1,68 @@
+/* client requests: input read inside and outside a tracing window,
+   queried and partly cleared. run it on any file of 32 bytes or more
+   with
+
+     valgrind --tool=ddtector --dd-trace=client --dd-output=queries \
+              ./tc4 <file>
+
+   build it with -I.. and the directory holding valgrind.h. the counts
+   it prints are the bytes the queries found tainted at the default
+   granularity, and the ones in [] are what they should be. with
+   --dd-granularity=8 the query at buf+35 starts inside a cell.
+
+     valgrind --tool=ddtector --dd-trace=client ./tc4 <file> stores
+
+   makes no queries, so the only stores reported are those of the
+   memcpy, each byte once */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "ddtector.h"
+
+// the two reads land in secondaries far apart, so a query over all of
+// it skips the clean ones in between
+static char buf[1 << 20];
+
+// not a constant, so the copy is a call to the replaced memcpy
+static volatile size_t copy_len = 8;
+
+static int no_queries;
+
+static void query(const char* what, char* p, unsigned long len, unsigned long want){
+  if(no_queries){
+    return;
+  }
+  unsigned long n = VALGRIND_DD_QUERY(p, len);
+  printf("tc4: %s: %lu [%lu]\n", what, n, want);
+}
+
+int main(int argc, char** argv){
+  int fd;
+
+  if(argc < 2 || (fd = open(argv[1], O_RDONLY)) < 0){
+    fprintf(stderr, "usage: tc4 <file> [stores]\n");
+    return 1;
+  }
+  no_queries = argc > 2;
+
+  read(fd, buf + 32, 16);                  // before the window, not labelled
+  query("before start", buf, sizeof(buf), 0);
+
+  VALGRIND_DD_START;
+  read(fd, buf + 32, 16);
+  read(fd, buf + 600000, 16);
+  memcpy(buf + 64, buf + 32, copy_len);
+  query("all", buf, sizeof(buf), 40);
+  query("inside a read", buf + 35, 6, 6);
+  VALGRIND_DD_CLEAR(buf + 40, 8);
+  query("after clear", buf + 32, 16, 8);
+  VALGRIND_DD_STOP;
+
+  // reading again outside the window overwrites the labelled bytes
+  read(fd, buf + 600000, 16);
+  query("after stop", buf, sizeof(buf), 16);
+
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,67 @@
+/* --dd-mode=bool: unaligned 8 and 16 byte copies of input, at every
+   offset, from and into the middle of a page and across a 4KB page
+   boundary. the copies are single loads and stores, so they take the
+   inline bit paths, across bitmap bytes and words, and the helper when
+   the shadow crosses into the next secondary. run it with
+
+     valgrind --tool=ddtector --dd-mode=bool ./tc5 < <file>
+
+   on a file of 64 bytes or more. build it with -O2, -I.. and the
+   directory holding valgrind.h. every copy must leave exactly its bytes
+   tainted; the ones that do not are printed */
+#include <stdio.h>
+#include <unistd.h>
+#include "ddtector.h"
+
+static char src[2 * 4096] __attribute__((aligned(4096)));
+static char dst[2 * 4096] __attribute__((aligned(4096)));
+
+static __attribute__((noinline)) void copy8(char* d, const char* s){
+  __builtin_memcpy(d, s, 8);
+}
+
+static __attribute__((noinline)) void copy16(char* d, const char* s){
+  __builtin_memcpy(d, s, 16);
+}
+
+int main(void){
+  char* in = src + 4096 - 32;
+  int n_bad = 0, n = 0;
+
+  if(read(STDIN_FILENO, in, 64) != 64){
+    fprintf(stderr, "usage: tc5 < <file of 64 bytes or more>\n");
+    return 1;
+  }
+
+  for(int size = 8; size <= 16; size += 8){
+    for(int off = 0; off < 16; off++){
+      // s runs into the next page for the larger offsets, d0 is in the
+      // middle of a page and d1 crosses into the next one
+      const char* s = in + 12 + off;
+      char* d0 = dst + 100 + off;
+      char* d1 = dst + 4096 - 12 + off;
+      char* ds[2] = { d0, d1 };
+
+      for(int k = 0; k < 2; k++){
+        if(size == 8){
+          copy8(ds[k], s);
+        }
+        else{
+          copy16(ds[k], s);
+        }
+        unsigned long t = VALGRIND_DD_QUERY(dst, sizeof(dst));
+        unsigned long t_in = VALGRIND_DD_QUERY(ds[k], size);
+        if(t != size || t_in != size){
+          printf("tc5: %d byte copy to dst+%ld: %lu tainted, %lu of them copied\n",
+                 size, (long)(ds[k] - dst), t, t_in);
+          n_bad++;
+        }
+        VALGRIND_DD_CLEAR(dst, sizeof(dst));
+        n++;
+      }
+    }
+  }
+
+  printf("tc5: %d of %d copies right\n", n - n_bad, n);
+  return n_bad != 0;
+}